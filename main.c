@@ -1,20 +1,52 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "src/execute.h"
-#include "src/meta.h"
-#include "src/prepare.h"
 #include "src/readline_hack.h"
 #include "src/data.h"
+#include "src/server.h"
+#include "src/session.h"
+#include "src/trace.h"
+
+void usage() {
+  puts("Usage: db [--direct] [--hash] [--serve <socket>] [--trace <file>] "
+       "[filename]");
+  exit(1);
+}
 
 int main(int argc, char* argv[]) {
   char* input;
   statement stmt;
   const char* filename = "db";
+  const char* socket_path = NULL;
+  const char* trace_path = NULL;
+  int flags = 0;
   table* t;
 
-  if (argc > 1) filename = argv[1];
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--direct")) flags |= DB_DIRECT_IO;
+    else if (!strcmp(argv[i], "--hash")) flags |= DB_HASH;
+    else if (!strcmp(argv[i], "--serve")) {
+      if (i + 1 == argc) usage();
+      socket_path = argv[++i];
+    } else if (!strcmp(argv[i], "--trace")) {
+      if (i + 1 == argc) usage();
+      trace_path = argv[++i];
+    } else filename = argv[i];
+  }
+
+  t = db_open(filename, flags);
 
-  t = db_open(filename);
+  if (trace_path && !(t->trace = trace_open(trace_path, flags))) {
+    printf("Unable to open trace file %s.\n", trace_path);
+    exit(1);
+  }
+
+  if (socket_path) {
+    int res = serve(t, socket_path);
+    db_close(t);
+    return res;
+  }
 
   while (1) {
     if (!(input = readline("> "))) {
@@ -23,39 +55,9 @@ int main(int argc, char* argv[]) {
     }
 
     add_history(input);
-    if (input[0] == ':') {
-      switch (meta(input, t)) {
-        case META_UNRECOGNIZED:
-          printf("Unrecognized command '%s'.\n", input);
-        default:
-          break;
-      }
-    } else {
-      switch (prepare_statement(input, &stmt)) {
-        case PREP_UNRECOGNIZED:
-          printf("Unrecognized keyword at start of '%s'.\n", input);
-          break;
-        case PREP_SYNTAX_ERROR:
-          printf("Syntax error. Could not parse statement '%s'.\n", input);
-          break;
-        case PREP_STRING_TOO_LONG:
-          puts("A string is too long.");
-          break;
-        case PREP_NEG_ID:
-          puts("ID must be positive.");
-          break;
-        case PREP_SUCCESS:
-          switch (execute(&stmt, t)) {
-            case EXEC_TABLE_FULL:
-              puts("Error: table full!");
-              break;
-            case EXEC_DUPLICATE_KEY:
-              puts("Error: duplicate key!");
-              break;
-            case EXEC_SUCCESS:
-              break;
-          }
-      }
+    if (session_eval(input, t, &stmt, stdout) == SESSION_QUIT) {
+      db_close(t);
+      exit(0);
     }
     free(input);
   }
@@ -0,0 +1,172 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/data.h"
+#include "src/session.h"
+#include "src/trace.h"
+
+// latency samples of one statement type, in nanoseconds
+typedef struct {
+  uint64_t* ns;
+  uint32_t n;
+  uint32_t cap;
+} latencies;
+
+void record_latency(latencies* l, uint64_t ns) {
+  if (l->n == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 64;
+    l->ns = realloc(l->ns, l->cap * sizeof(uint64_t));
+  }
+  l->ns[l->n++] = ns;
+}
+
+int compare_ns(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of sorted samples, in microseconds
+double percentile(latencies* l, uint32_t pct) {
+  uint32_t rank = ((uint64_t)l->n * pct + 99) / 100;
+  return l->ns[rank ? rank - 1 : 0] / 1000.0;
+}
+
+void print_latencies(const char* label, latencies* by_type) {
+  printf("%s latency (us):\n", label);
+  printf("%-8s %8s %10s %10s %10s %10s %10s\n",
+         "type", "count", "min", "p50", "p90", "p99", "max");
+
+  for (int i = 0; i < TRACE_META; i++) {
+    latencies* l = &by_type[i];
+    if (!l->n) continue;
+
+    qsort(l->ns, l->n, sizeof(uint64_t), compare_ns);
+    printf("%-8s %8u %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+           trace_type_name(i), l->n, percentile(l, 0), percentile(l, 50),
+           percentile(l, 90), percentile(l, 99), percentile(l, 100));
+  }
+}
+
+// copies the database so that replaying never modifies it; a missing
+// database replays against an empty one
+void copy_db(const char* from, const char* to) {
+  char buf[PAGE_SIZE];
+  ssize_t n;
+  int in = open(from, O_RDONLY);
+  int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+
+  if (out < 0 || (in < 0 && errno != ENOENT)) {
+    printf("Unable to copy %s to %s.\n", from, to);
+    exit(1);
+  }
+
+  while (in >= 0 && (n = read(in, buf, sizeof(buf))) > 0) {
+    if (write(out, buf, n) != n) {
+      printf("Error writing %s: %d\n", to, errno);
+      exit(1);
+    }
+  }
+
+  if (in >= 0) close(in);
+  close(out);
+}
+
+// sleeps until offset nanoseconds after base
+void wait_until(const struct timespec* base, uint64_t offset) {
+  struct timespec now, delay;
+  uint64_t elapsed;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = elapsed_ns(base, &now);
+  if (elapsed >= offset) return;
+
+  delay.tv_sec = (offset - elapsed) / 1000000000;
+  delay.tv_nsec = (offset - elapsed) % 1000000000;
+  nanosleep(&delay, NULL);
+}
+
+int main(int argc, char* argv[]) {
+  const char* trace_path = NULL;
+  const char* db_path = NULL;
+  char* copy_path;
+  char* input;
+  short timed = 0;
+  uint32_t replayed = 0, skipped = 0;
+  latencies recorded[TRACE_META], replay[TRACE_META];
+  struct timespec began, start, end;
+  trace_header h;
+  trace_record rec;
+  statement stmt;
+  FILE* trace_file;
+  FILE* devnull;
+  table* t;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--timed")) timed = 1;
+    else if (!trace_path) trace_path = argv[i];
+    else db_path = argv[i];
+  }
+
+  if (!db_path) {
+    puts("Usage: db-replay [--timed] <trace> <db>");
+    exit(1);
+  }
+
+  if (!(trace_file = trace_read_open(trace_path, &h))) {
+    printf("%s is not a valid trace.\n", trace_path);
+    exit(1);
+  }
+
+  copy_path = malloc(strlen(db_path) + strlen(".replay") + 1);
+  sprintf(copy_path, "%s.replay", db_path);
+  copy_db(db_path, copy_path);
+
+  t = db_open(copy_path, h.flags);
+  devnull = fopen("/dev/null", "w");
+  memset(recorded, 0, sizeof(recorded));
+  memset(replay, 0, sizeof(replay));
+
+  // meta commands and lines that did not parse are not replayed
+  clock_gettime(CLOCK_MONOTONIC, &began);
+  while ((input = trace_read(trace_file, &rec))) {
+    if (rec.type >= TRACE_META) {
+      skipped++;
+      free(input);
+      continue;
+    }
+
+    if (timed) wait_until(&began, rec.start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    session_eval(input, t, &stmt, devnull);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    record_latency(&recorded[rec.type], rec.latency);
+    record_latency(&replay[rec.type], elapsed_ns(&start, &end));
+    replayed++;
+    free(input);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("Replayed %u statements (%u skipped) in %.3f ms.\n",
+         replayed, skipped, elapsed_ns(&began, &end) / 1000000.0);
+  print_latencies("Recorded", recorded);
+  print_latencies("Replayed", replay);
+
+  for (int i = 0; i < TRACE_META; i++) {
+    free(recorded[i].ns);
+    free(replay[i].ns);
+  }
+  fclose(devnull);
+  fclose(trace_file);
+  db_close(t);
+  unlink(copy_path);
+  free(copy_path);
+
+  return 0;
+}
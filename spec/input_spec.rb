@@ -1,9 +1,11 @@
+require 'socket'
+
 describe 'database' do
   DB_FILE = "test"
 
-  def run_script(commands, delete=true)
+  def run_script(commands, delete=true, options=[])
     raw_output = nil
-    IO.popen(["bin/db", DB_FILE], "r+") do |pipe|
+    IO.popen(["bin/db", *options, DB_FILE], "r+") do |pipe|
       commands.each do |command|
         begin
           pipe.puts command
@@ -104,6 +106,417 @@ describe 'database' do
     ])
   end
 
+  it 'reports checkpoints of written-back statements' do
+    result = run_script([
+      "insert 1 user1 person1@example.com",
+      "insert 2 user2 person2@example.com",
+      ":checkpoint",
+      "select",
+      ":q",
+    ])
+    expect(result).to match_array([
+      "Checkpoint: 2 statements durable.",
+      "(1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "Goodbye!",
+    ])
+  end
+
+  it 'serves pages from a pre-sized arena' do
+    result = run_script([
+      ":pager",
+      ":q",
+    ])
+    expect(result).to include(
+      "Pager:",
+      "direct I/O: no",
+      "cached pages: 1/100",
+    )
+  end
+
+  it 'inserts several rows in one statement' do
+    result = run_script([
+      "insert values (3, 'user3', 'person3@example.com'), (1, 'user 1', 'person1@example.com')",
+      "insert values (2,user2,person2@example.com)",
+      "select",
+      ":q",
+    ])
+    expect(result).to match_array([
+      "(1, user 1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "(3, user3, person3@example.com)",
+      "Goodbye!",
+    ])
+  end
+
+  it 'skips duplicate ids in a multi-row insert' do
+    result = run_script([
+      "insert 2 user2 person2@example.com",
+      "insert values (1, 'a', 'a@example.com'), (2, 'b', 'b@example.com'), (1, 'c', 'c@example.com')",
+      "select",
+      ":q",
+    ])
+    expect(result).to match_array([
+      "Error: duplicate key!",
+      "(1, a, a@example.com)",
+      "(2, user2, person2@example.com)",
+      "Goodbye!",
+    ])
+  end
+
+  it 'rejects malformed multi-row inserts' do
+    result = run_script([
+      "insert values (1, 'a', 'a@example.com'), (2, 'b')",
+      "select",
+      ":q",
+    ])
+    expect(result).to match_array([
+      "Syntax error. Could not parse statement 'insert values (1, 'a', 'a@example.com'), (2, 'b')'.",
+      "Goodbye!",
+    ])
+  end
+
+  it 'vacuums the table into packed leaves' do
+    script = [5, 3, 1, 4, 2, 6, 7, 8].map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ":vacuum 50"
+    script << ":tree"
+    script << ":q"
+    result = run_script(script, delete=false)
+    expect(result).to match_array([
+      "Vacuumed.",
+      "Tree:",
+      "- internal (size 1)",
+      "  - leaf (size 6)",
+      "    - 1",
+      "    - 2",
+      "    - 3",
+      "    - 4",
+      "    - 5",
+      "    - 6",
+      "- key 6",
+      "  - leaf (size 2)",
+      "    - 7",
+      "    - 8",
+      "Goodbye!",
+    ])
+
+    result = run_script([
+      "select",
+      ":q",
+    ])
+    expect(result).to match_array((1..8).map do |i|
+      "(#{i}, user#{i}, person#{i}@example.com)"
+    end + ["Goodbye!"])
+  end
+
+  it 'serves pipelined statements over a unix socket' do
+    socket_path = "test.sock"
+    pid = Process.spawn("bin/db", "--serve", socket_path, DB_FILE)
+    50.times do
+      break if File.exist?(socket_path)
+      sleep 0.1
+    end
+
+    replies = [
+      "insert 1 user1 person1@example.com\ninsert 2 user2 person2@example.com\n:q\n",
+      "insert 2 user2 person2@example.com\nselect\n:q\n",
+      ":d\nselect where id = 1\n:q\n",
+    ].map do |request|
+      UNIXSocket.open(socket_path) do |sock|
+        sock.write(request)
+        sock.read
+      end
+    end
+
+    Process.kill("TERM", pid)
+    Process.wait(pid)
+
+    expect(replies[0]).to eq("\n\nGoodbye!\n\n")
+    expect(replies[1]).to eq(
+      "Error: duplicate key!\n\n" \
+      "(1, user1, person1@example.com)\n(2, user2, person2@example.com)\n\n" \
+      "Goodbye!\n\n"
+    )
+    debug, select, goodbye = replies[2].split("\n\n")
+    expect(debug).to match(/LNODE_MAX_CELLS: 13\nTree:\n/)
+    expect([select, goodbye]).to eq([
+      "(1, user1, person1@example.com)",
+      "Goodbye!",
+    ])
+
+    result = run_script([
+      "select",
+      ":q",
+    ])
+    expect(result).to match_array([
+      "(1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "Goodbye!",
+    ])
+  end
+
+  it 'prints usage when --serve has no socket path' do
+    result = IO.popen(["bin/db", "--serve"], &:read)
+    expect($?.exitstatus).to eq(1)
+    expect(result).to match(/^Usage: db /)
+    expect(File.exist?("--serve")).to eq(false)
+  end
+
+  it 'looks up single rows by id' do
+    script = (1..20).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "select where id = 15"
+    script << "select where id = 21"
+    script << ":q"
+    result = run_script(script)
+    expect(result).to match_array([
+      "(15, user15, person15@example.com)",
+      "Goodbye!",
+    ])
+  end
+
+  it 'stores tables created with --hash in an extendible hash' do
+    script = (1..40).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "insert 7 user7 person7@example.com"
+    script << "select where id = 23"
+    script << ":q"
+    result = run_script(script, delete=false, options=["--hash"])
+    expect(result).to match_array([
+      "Error: duplicate key!",
+      "(23, user23, person23@example.com)",
+      "Goodbye!",
+    ])
+
+    result = run_script([
+      ":tree",
+      "select",
+      ":vacuum",
+      ":q",
+    ])
+    expect(result[0..1]).to eq([
+      "Tree:",
+      "- hash directory (depth 2)",
+    ])
+    expect(result.select { |line| line.start_with?("(") }).to match_array(
+      (1..40).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" }
+    )
+    expect(result[-2..-1]).to eq([
+      "Error: only B-tree tables can be vacuumed!",
+      "Goodbye!",
+    ])
+  end
+
+  it 'spreads leaves evenly over the internal nodes of a vacuumed tree' do
+    script = (1..40).map do |i|
+      "insert #{i * 10} user#{i * 10} person#{i * 10}@example.com"
+    end
+    script << ":vacuum 70"
+    script << ":tree"
+    script << ":q"
+    result = run_script(script)
+    expect(result.reject { |line| line =~ /^ *- \d+$/ }).to eq([
+      "Vacuumed.",
+      "Tree:",
+      "- internal (size 1)",
+      "  - internal (size 2)",
+      "    - leaf (size 9)",
+      "  - key 90",
+      "    - leaf (size 9)",
+      "  - key 180",
+      "    - leaf (size 9)",
+      "- key 270",
+      "  - internal (size 1)",
+      "    - leaf (size 9)",
+      "  - key 360",
+      "    - leaf (size 4)",
+      "Goodbye!",
+    ])
+  end
+
+  it 'keeps accepting inserts between existing keys after a vacuum' do
+    script = (1..50).map do |i|
+      "insert #{i * 10} user#{i * 10} person#{i * 10}@example.com"
+    end
+    script << ":vacuum"
+    script << "insert 3 user3 person3@example.com"
+    script << "insert 255 user255 person255@example.com"
+    script << "select count(*)"
+    script << "select where id between 1 and 20"
+    script << "select where id = 255"
+    script << ":q"
+    result = run_script(script)
+    expect(result).to eq([
+      "Vacuumed.",
+      "52",
+      "(3, user3, person3@example.com)",
+      "(10, user10, person10@example.com)",
+      "(20, user20, person20@example.com)",
+      "(255, user255, person255@example.com)",
+      "Goodbye!",
+    ])
+  end
+
+  it 'counts, ranks and pages through rows in id order' do
+    script = (1..30).to_a.shuffle(random: Random.new(4)).map do |i|
+      "insert #{i * 2} user#{i * 2} person#{i * 2}@example.com"
+    end
+    script << "select count(*)"
+    script << "select count(*) where id between 11 and 20"
+    script << "select rank 31"
+    script << "select limit 2 offset 25"
+    script << "select where id between 30 and 60 limit 1 offset 3"
+    script << "select where id between 30 and 60 offset 4294967295"
+    script << ":q"
+    result = run_script(script)
+    expect(result).to eq([
+      "30",
+      "5",
+      "15",
+      "(52, user52, person52@example.com)",
+      "(54, user54, person54@example.com)",
+      "(36, user36, person36@example.com)",
+      "Goodbye!",
+    ])
+  end
+
+  it 'adds subtree counts to internal nodes written by older versions' do
+    legacy_leaf = lambda do |id, next_leaf|
+      cell = [id, id].pack("L<L<") + "user#{id}".ljust(33, "\0") +
+        "person#{id}@example.com".ljust(256, "\0")
+      ([1, 0, 0, 1, next_leaf].pack("CCL<L<L<") + cell).ljust(4096, "\0")
+    end
+    root = [0, 1, 0, 1, 2, 1, 1].pack("CCL<L<L<L<L<").ljust(4096, "\0")
+    File.binwrite(DB_FILE, root + legacy_leaf.(1, 2) + legacy_leaf.(2, 0))
+
+    result = run_script([
+      "select count(*)",
+      "select rank 2",
+      "select limit 1 offset 1",
+      ":q",
+    ])
+    expect(result).to eq([
+      "2",
+      "1",
+      "(2, user2, person2@example.com)",
+      "Goodbye!",
+    ])
+  end
+
+  it 'rejects a legacy internal node whose children are not in the tree' do
+    File.binwrite(DB_FILE, "\0" * 8192)
+
+    result = run_script([":q"])
+    expect(result).to eq([
+      "Internal node points outside the tree. Corrupt file.",
+    ])
+  end
+
+  it 'refuses to rank rows of a hash table' do
+    result = run_script([
+      "insert 1 user1 person1@example.com",
+      "select rank 1",
+      "select count(*)",
+      ":q",
+    ], delete=true, options=["--hash"])
+    expect(result).to eq([
+      "Error: table is not ordered!",
+      "1",
+      "Goodbye!",
+    ])
+  end
+
+  it 'exports a columnar snapshot and reads it back' do
+    snapshot = "test.cols"
+    script = [3, 1, 2].map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ":export #{snapshot}"
+    script << ":snapshot #{snapshot}"
+    script << ":snapshot #{DB_FILE}"
+    script << ":q"
+    result = run_script(script)
+    File.delete(snapshot)
+    expect(result).to eq([
+      "Exported 3 rows.",
+      "Snapshot: 3 rows in 1 blocks",
+      "block 0: ids 1-3",
+      "(1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "(3, user3, person3@example.com)",
+      "Error: #{DB_FILE} is not a valid snapshot.",
+      "Goodbye!",
+    ])
+  end
+
+  it 'records a trace and replays it against a copy of the database' do
+    trace = "test.trace"
+    script = (1..5).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "select count(*)"
+    script << "select where id = 3"
+    script << ":tree"
+    script << "bogus"
+    script << ":q"
+    run_script(script, delete=true, options=["--trace", trace])
+
+    result = IO.popen(["bin/db-replay", trace, DB_FILE]).read.split("\n")
+    File.delete(trace)
+    expect(File.exist?("#{DB_FILE}.replay")).to eq(false)
+    expect(result[0]).to match(/^Replayed 7 statements \(3 skipped\) in /)
+    counts = result.map(&:split).select { |cols| cols.length == 7 }
+    expect(counts.map { |cols| cols[0..1] }).to eq([
+      ["type", "count"],
+      ["insert", "5"],
+      ["select", "1"],
+      ["count", "1"],
+      ["type", "count"],
+      ["insert", "5"],
+      ["select", "1"],
+      ["count", "1"],
+    ])
+  end
+
+  it 'refuses a snapshot with a corrupt string offset' do
+    snapshot = "test.cols"
+    run_script([
+      "insert 1 user1 person1@example.com",
+      "insert 2 user2 person2@example.com",
+      ":export #{snapshot}",
+      ":q",
+    ])
+    data = File.binread(snapshot)
+    username_offsets = data[32, 8].unpack1("Q<")
+    data[username_offsets + 4, 4] = [0xfffff000].pack("L<")
+    File.binwrite(snapshot, data)
+
+    result = run_script([
+      ":snapshot #{snapshot}",
+      ":q",
+    ])
+    File.delete(snapshot)
+    expect(result).to eq([
+      "Error: #{snapshot} is not a valid snapshot.",
+      "Goodbye!",
+    ])
+  end
+
+  it 'counts bucket splits and directory doublings of a hash table' do
+    script = (1..40).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ":splits"
+    script << ":q"
+    result = run_script(script, delete=true, options=["--hash"])
+    expect(result).to include("total: 0", "buckets: 3",
+                              "directory doublings: 2")
+  end
+
   it 'prints constants' do
       script = [
         ":c",
@@ -182,7 +595,7 @@ describe 'database' do
     ])
   end
 
-  it 'allows printing out the structure of a 3-leaf-node btree' do
+  it 'keeps the left leaf full when sequential inserts split the last leaf' do
     script = (1..14).map do |i|
       "insert #{i} user#{i} person#{i}@example.com"
     end
@@ -194,7 +607,7 @@ describe 'database' do
     expect(result[14...(result.length)]).to match_array([
       "Tree:",
       "- internal (size 1)",
-      "  - leaf (size 7)",
+      "  - leaf (size 13)",
       "    - 1",
       "    - 2",
       "    - 3",
@@ -202,19 +615,88 @@ describe 'database' do
       "    - 5",
       "    - 6",
       "    - 7",
-      "- key 7",
-      "  - leaf (size 7)",
       "    - 8",
       "    - 9",
       "    - 10",
       "    - 11",
       "    - 12",
       "    - 13",
+      "- key 13",
+      "  - leaf (size 1)",
       "    - 14",
       "Goodbye!"
     ])
   end
 
+  it 'splits the rightmost leaf at the fill factor when appending a new key' do
+    script = [":fillfactor 75"]
+    script += [5, 3, 9, 1, 7, 11, 2, 13, 4, 12, 6, 10, 8, 14].map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ":tree"
+    script << ":splits"
+    script << ":q"
+    result = run_script(script)
+
+    expect(result.reject { |line| line.start_with?("    - ") }).to eq([
+      "Tree:",
+      "- internal (size 1)",
+      "  - leaf (size 9)",
+      "- key 9",
+      "  - leaf (size 5)",
+      "Splits:",
+      "fill factor: 75",
+      "total: 1",
+      "append: 1",
+      "prepend: 0",
+      "middle: 0",
+      "Goodbye!",
+    ])
+  end
+
+  it 'keeps leaves full for an ascending run inside the key range' do
+    script = ((1..13).to_a + [1000] + (14..30).to_a).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ":tree"
+    script << ":q"
+    result = run_script(script)
+
+    expect(result.reject { |line| line.start_with?("    - ") }).to eq([
+      "Tree:",
+      "- internal (size 2)",
+      "  - leaf (size 13)",
+      "- key 13",
+      "  - leaf (size 12)",
+      "- key 25",
+      "  - leaf (size 6)",
+      "Goodbye!",
+    ])
+  end
+
+  it 'splits in the middle for random inserts and honours the fill factor' do
+    script = [":fillfactor 50"]
+    script += [7, 3, 11, 1, 9, 5, 13, 2, 8, 14, 4, 12, 6, 10].map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script += (15..22).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ":splits"
+    script << ":q"
+    result = run_script(script)
+
+    expect(result).to match_array([
+      "Splits:",
+      "fill factor: 50",
+      "total: 2",
+      "append: 1",
+      "prepend: 0",
+      "middle: 1",
+      "Goodbye!",
+    ])
+  end
+
   it 'allows printing out the structure of a 4-leaf-node btree' do
     script = [
       "insert 18 user18 person18@example.com",
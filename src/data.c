@@ -3,10 +3,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "data.h"
+#include "hash.h"
 #include "serialize.h"
+#include "trace.h"
+#include "writer.h"
 
 const uint32_t NODE_T_SIZE = sizeof(uint8_t);
 const uint32_t NODE_T_OFFSET = 0;
@@ -35,18 +39,25 @@ const uint32_t LNODE_MAX_CELLS = LNODE_SPACE_FOR_CELLS / LNODE_CELL_SIZE;
 const uint32_t LNODE_RIGHT_SPLIT_COUNT = (LNODE_MAX_CELLS+1) / 2;
 const uint32_t LNODE_LEFT_SPLIT_COUNT =
   (LNODE_MAX_CELLS+1) - LNODE_RIGHT_SPLIT_COUNT;
+const uint32_t LNODE_SPLIT_TOTAL = LNODE_MAX_CELLS + 1;
 
 const uint32_t INODE_NUM_KEYS_SIZE = sizeof(uint32_t);
 const uint32_t INODE_NUM_KEYS_OFFSET = NODE_HDR_SIZE;
 const uint32_t INODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INODE_RIGHT_CHILD_OFFSET =
   INODE_NUM_KEYS_OFFSET + INODE_NUM_KEYS_SIZE;
-const uint32_t INODE_HDR_SIZE =
-  NODE_HDR_SIZE + INODE_NUM_KEYS_SIZE + INODE_RIGHT_CHILD_SIZE;
+const uint32_t INODE_RIGHT_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t INODE_RIGHT_COUNT_OFFSET =
+  INODE_RIGHT_CHILD_OFFSET + INODE_RIGHT_CHILD_SIZE;
+const uint32_t INODE_HDR_SIZE = NODE_HDR_SIZE + INODE_NUM_KEYS_SIZE +
+  INODE_RIGHT_CHILD_SIZE + INODE_RIGHT_COUNT_SIZE;
 
+// every child pointer carries the number of rows in the child's subtree
 const uint32_t INODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t INODE_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INODE_CELL_SIZE = INODE_CHILD_SIZE + INODE_KEY_SIZE;
+const uint32_t INODE_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t INODE_CELL_SIZE =
+  INODE_CHILD_SIZE + INODE_KEY_SIZE + INODE_COUNT_SIZE;
 const uint32_t INODE_MAX_CELLS = 3;
 
 uint8_t is_node_root(uint8_t* node) {
@@ -64,8 +75,10 @@ uint8_t* get_page(pager* p, uint32_t page_num) {
     exit(1);
   }
 
-  if (p->pages[page_num] == NULL) {
-    uint8_t* page = malloc(PAGE_SIZE);
+  if (p->pages[page_num] != NULL) {
+    p->page_hits++;
+  } else {
+    uint8_t* page = p->arena + (size_t)page_num * PAGE_SIZE;
     uint32_t num_pages = p->flen / PAGE_SIZE;
 
     if (p->flen % PAGE_SIZE) num_pages += 1;
@@ -80,6 +93,7 @@ uint8_t* get_page(pager* p, uint32_t page_num) {
     }
 
     p->pages[page_num] = page;
+    p->page_misses++;
 
     if (page_num >= p->npages) {
       p->npages = page_num + 1;
@@ -102,6 +116,11 @@ void cursor_advance(cursor* c) {
   uint32_t page_num = c->pagen;
   uint8_t* node = get_page(c->table->pager, page_num);
 
+  if (get_node_type(node) == HASH_BUCKET) {
+    hash_cursor_advance(c);
+    return;
+  }
+
   c->celln += 1;
 
   if (c->celln >= *lnode_num_cells(node)) {
@@ -115,11 +134,64 @@ void cursor_advance(cursor* c) {
   }
 }
 
-pager* pager_open(const char* filename) {
+// all frames live in one page-aligned mapping. We try explicit huge pages
+// first and fall back to a normal mapping, asking for transparent huge pages
+// where the kernel supports that.
+void pager_map_arena(pager* p) {
+  size_t size = (size_t)TABLE_MAX_PAGES * PAGE_SIZE;
+  void* arena;
+
+#ifdef MAP_HUGETLB
+  size_t huge_size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE-1);
+
+  arena = mmap(NULL, huge_size, PROT_READ|PROT_WRITE,
+               MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+  if (arena != MAP_FAILED) {
+    p->arena = arena;
+    p->arena_size = huge_size;
+    p->huge_pages = 1;
+    return;
+  }
+#endif
+
+  arena = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+               -1, 0);
+  if (arena == MAP_FAILED) {
+    printf("Error mapping page arena: %d.\n", errno);
+    exit(1);
+  }
+
+#ifdef MADV_HUGEPAGE
+  madvise(arena, size, MADV_HUGEPAGE);
+#endif
+
+  p->arena = arena;
+  p->arena_size = size;
+  p->huge_pages = 0;
+}
+
+int open_db_file(const char* filename, int flags) {
+  int oflags = O_RDWR|O_CREAT;
+  int fd;
+
+#ifdef O_DIRECT
+  if (flags & DB_DIRECT_IO) oflags |= O_DIRECT;
+#endif
+
+  fd = open(filename, oflags, S_IWUSR|S_IRUSR);
+
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+  if (fd >= 0 && (flags & DB_DIRECT_IO)) fcntl(fd, F_NOCACHE, 1);
+#endif
+
+  return fd;
+}
+
+pager* pager_open(const char* filename, int flags) {
   int i;
   off_t flen;
   pager* p;
-  int fd = open(filename, O_RDWR|O_CREAT, S_IWUSR|S_IRUSR);
+  int fd = open_db_file(filename, flags);
 
   if (fd < 0) {
     puts("Error opening DB file.");
@@ -132,77 +204,169 @@ pager* pager_open(const char* filename) {
   p->fd = fd;
   p->flen = flen;
   p->npages = flen / PAGE_SIZE;
+  p->ndirty = 0;
+  p->epoch = 0;
+  p->checkpoint = 0;
+  p->pages_written = 0;
+  p->page_hits = 0;
+  p->page_misses = 0;
+  p->writer_running = 0;
+  p->writer_stop = 0;
+  p->writing = -1;
+  p->direct_io = (flags & DB_DIRECT_IO) != 0;
+  p->filename = malloc(strlen(filename) + 1);
+  strcpy(p->filename, filename);
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->wake, NULL);
+  pthread_cond_init(&p->written, NULL);
 
   if (flen % PAGE_SIZE) {
     puts("DB file is not a whole number of pages. Corrupt file.");
     exit(1);
   }
 
-  for (i = 0; i < TABLE_MAX_PAGES; i++) p->pages[i] = NULL;
+  for (i = 0; i < TABLE_MAX_PAGES; i++) {
+    p->pages[i] = NULL;
+    p->dirty[i] = 0;
+  }
+
+  pager_map_arena(p);
 
   return p;
 }
 
-table* db_open(const char* filename) {
+table* db_open(const char* filename, int flags) {
   uint8_t* root;
-  pager* p = pager_open(filename);
+  pager* p = pager_open(filename, flags);
 
   table* res = malloc(sizeof(table));
   res->pager = p;
   res->root_page_num = 0;
-
-  if (!p->npages) {
+  res->fill_factor = DEFAULT_FILL_FACTOR;
+  res->last_key = 0;
+  res->insert_run = 0;
+  res->splits.total = 0;
+  res->splits.append = 0;
+  res->splits.prepend = 0;
+  res->splits.buckets = 0;
+  res->splits.doublings = 0;
+  res->trace = NULL;
+
+  if (!p->npages && (flags & DB_HASH)) {
+    initialize_hash(res);
+  } else if (!p->npages) {
     root = get_page(p, 0);
     initialize_lnode(root);
     set_node_root(root, 1);
+    pager_mark_dirty(p, 0);
+  } else if (get_node_type(get_page(p, 0)) == LEGACY_INTERNAL) {
+    upgrade_node(p, 0);
   }
 
+  writer_start(p);
+
   return res;
 }
 
+// callers hold p->lock (or own the pager exclusively, e.g. before the
+// background writer is started)
+void pager_mark_dirty(pager* p, uint32_t page_num) {
+  if (p->dirty[page_num]) return;
+
+  p->dirty[page_num] = 1;
+  p->dirty_since[page_num] = p->epoch;
+  p->ndirty++;
+
+  if (p->ndirty >= DIRTY_HIGH_WATERMARK) pthread_cond_signal(&p->wake);
+}
+
+// writes a single page back and marks it clean; callers hold p->lock.
+// pwrite is used so the writer thread never moves the file offset that
+// get_page relies on.
 void pager_flush(pager* p, uint32_t page_num) {
   if (!p->pages[page_num]) {
     puts("Tried to flush null page.");
     exit(1);
   }
 
-  if (lseek(p->fd, page_num*PAGE_SIZE, SEEK_SET) < 0) {
-    printf("Error seeking: %d.\n", errno);
-    exit(1);
+  while (p->writing == (int)page_num) {
+    pthread_cond_wait(&p->written, &p->lock);
   }
 
-  if (write(p->fd, p->pages[page_num], PAGE_SIZE) < 0) {
+  if (pwrite(p->fd, p->pages[page_num], PAGE_SIZE,
+             (off_t)page_num*PAGE_SIZE) < 0) {
     printf("Error writing: %d.\n", errno);
     exit(1);
   }
+
+  if (p->dirty[page_num]) {
+    p->dirty[page_num] = 0;
+    p->ndirty--;
+  }
+  p->pages_written++;
 }
 
-void db_close(table* t) {
+// makes every statement completed so far durable. pager_flush may drop the
+// lock while it waits for the writer, so statements that run meanwhile are
+// not counted; and the page the writer has in flight was already marked
+// clean, so its write has to finish before the fsync can cover it.
+uint64_t pager_checkpoint(pager* p) {
   int i;
-  uint8_t* page;
-  pager* p = t->pager;
+  uint64_t res;
 
-  for (i = 0; i < p->npages; i++) {
-    if (!p->pages[i]) continue;
+  pthread_mutex_lock(&p->lock);
+  res = p->epoch;
 
-    pager_flush(p, i);
+  for (i = 0; i < TABLE_MAX_PAGES; i++) {
+    if (p->dirty[i]) pager_flush(p, i);
   }
 
-  if (close(p->fd) < 0) {
-    puts("Error closing DB file.");
+  while (p->writing >= 0) pthread_cond_wait(&p->written, &p->lock);
+
+  if (fsync(p->fd) < 0) {
+    printf("Error syncing: %d.\n", errno);
     exit(1);
   }
 
-  for (i = 0; i < TABLE_MAX_PAGES; i++) {
-    page = p->pages[i];
+  if (res > p->checkpoint) p->checkpoint = res;
+  pthread_mutex_unlock(&p->lock);
 
-    if (page) free(page);
+  return res;
+}
+
+void pager_close(pager* p) {
+  // the writer has usually trickled most pages out already, so this only
+  // has to deal with whatever was dirtied since its last pass
+  writer_stop(p);
+  pager_checkpoint(p);
+
+  if (close(p->fd) < 0) {
+    puts("Error closing DB file.");
+    exit(1);
   }
 
+  munmap(p->arena, p->arena_size);
+
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->wake);
+  pthread_cond_destroy(&p->written);
+  free(p->filename);
   free(p);
 }
 
+void db_close(table* t) {
+  if (t->trace) trace_close(t->trace);
+  pager_close(t->pager);
+  free(t);
+}
+
+short table_is_hashed(table* t) {
+  return get_node_type(get_page(t->pager, t->root_page_num)) == HASH_DIRECTORY;
+}
+
 cursor* table_start(table* t) {
+  if (table_is_hashed(t)) return hash_start(t);
+
   cursor* c = table_find(t, 0);
 
   uint8_t* node = get_page(t->pager, c->pagen);
@@ -212,6 +376,24 @@ cursor* table_start(table* t) {
   return c;
 }
 
+// returns a cursor at the first row with an id of at least key
+cursor* table_seek(table* t, uint32_t key) {
+  cursor* c = table_find(t, key);
+  uint8_t* node = get_page(t->pager, c->pagen);
+
+  c->end_of_table = 0;
+  if (c->celln >= *lnode_num_cells(node)) {
+    if (*lnode_next_leaf(node)) {
+      c->pagen = *lnode_next_leaf(node);
+      c->celln = 0;
+    } else {
+      c->end_of_table = 1;
+    }
+  }
+
+  return c;
+}
+
 cursor* table_find(table* t, uint32_t key) {
   uint32_t root_page_num = t->root_page_num;
   uint8_t* root = get_page(t->pager, root_page_num);
@@ -257,6 +439,113 @@ uint32_t* inode_key(uint8_t* node, uint32_t key_num) {
   return (uint32_t*)((uint8_t*)inode_cell(node, key_num) + INODE_CHILD_SIZE);
 }
 
+uint32_t* inode_right_count(uint8_t* node) {
+  return (uint32_t*)(node + INODE_RIGHT_COUNT_OFFSET);
+}
+
+uint32_t* inode_count(uint8_t* node, uint32_t child_num) {
+  if (child_num == *inode_num_keys(node)) return inode_right_count(node);
+
+  return (uint32_t*)((uint8_t*)inode_cell(node, child_num) + INODE_CHILD_SIZE +
+                     INODE_KEY_SIZE);
+}
+
+uint32_t inode_child_index(uint8_t* node, uint32_t child_pn) {
+  uint32_t i, num_keys = *inode_num_keys(node);
+
+  for (i = 0; i < num_keys; i++) {
+    if (*inode_child(node, i) == child_pn) return i;
+  }
+
+  return num_keys;
+}
+
+uint32_t node_row_count(pager* p, uint32_t page_num) {
+  uint8_t* node = get_page(p, page_num);
+  uint32_t i, res = 0;
+
+  if (get_node_type(node) == LEAF) return *lnode_num_cells(node);
+
+  for (i = 0; i <= *inode_num_keys(node); i++) res += *inode_count(node, i);
+
+  return res;
+}
+
+// the number of rows under a child of a legacy node, upgrading the child
+// first if it is a legacy node too. A child must be a page of the file
+// other than its parent, and a leaf or a legacy node not visited yet; since
+// visited nodes are already upgraded, a cycle shows up as the wrong type.
+uint32_t upgrade_child(pager* p, uint32_t parent_pn, uint32_t child_pn) {
+  uint8_t* child;
+
+  if (child_pn == parent_pn || child_pn >= p->flen / PAGE_SIZE) {
+    puts("Internal node points outside the tree. Corrupt file.");
+    exit(1);
+  }
+
+  child = get_page(p, child_pn);
+  switch (get_node_type(child)) {
+    case LEAF:
+      if (*lnode_num_cells(child) > LNODE_MAX_CELLS) break;
+      return *lnode_num_cells(child);
+    case LEGACY_INTERNAL:
+      return upgrade_node(p, child_pn);
+    default:
+      break;
+  }
+
+  puts("Internal node points to an invalid page. Corrupt file.");
+  exit(1);
+}
+
+// rewrites a tree of LEGACY_INTERNAL nodes, whose cells hold only a child
+// and a key, in the current layout with subtree counts, children first.
+// Returns the number of rows under page_num.
+uint32_t upgrade_node(pager* p, uint32_t page_num) {
+  uint8_t legacy[PAGE_SIZE];
+  uint8_t* node = get_page(p, page_num);
+  uint32_t* cells = (uint32_t*)(legacy + INODE_RIGHT_COUNT_OFFSET);
+  uint32_t i, num_keys;
+
+  // the number of keys and the right child are where they always were;
+  // legacy cells started where the right child's count is now
+  memcpy(legacy, node, PAGE_SIZE);
+  num_keys = *inode_num_keys(node);
+  if (num_keys > INODE_MAX_CELLS) {
+    puts("Internal node has too many keys. Corrupt file.");
+    exit(1);
+  }
+  set_node_type(node, INTERNAL);
+
+  for (i = 0; i < num_keys; i++) {
+    *inode_child(node, i) = cells[2*i];
+    *inode_key(node, i) = cells[2*i + 1];
+    *inode_count(node, i) = upgrade_child(p, page_num, cells[2*i]);
+  }
+  *inode_right_count(node) =
+    upgrade_child(p, page_num, *inode_right_child(node));
+  pager_mark_dirty(p, page_num);
+
+  return node_row_count(p, page_num);
+}
+
+// adds delta to the subtree counts on the path from page_num to the root
+void update_counts(table* t, uint32_t page_num, int32_t delta) {
+  uint8_t* node = get_page(t->pager, page_num);
+  uint32_t parent_pn;
+  uint8_t* parent;
+
+  while (!is_node_root(node)) {
+    parent_pn = *node_parent(node);
+    parent = get_page(t->pager, parent_pn);
+    *inode_count(parent, inode_child_index(parent, page_num)) += delta;
+    pager_mark_dirty(t->pager, parent_pn);
+
+    page_num = parent_pn;
+    node = parent;
+  }
+}
+
 uint32_t inode_find_child(uint8_t* node, uint32_t key) {
   uint32_t num_keys = *inode_num_keys(node);
 
@@ -276,6 +565,63 @@ uint32_t inode_find_child(uint8_t* node, uint32_t key) {
   return min_index;
 }
 
+uint32_t table_count(table* t) {
+  if (table_is_hashed(t)) return hash_count(t);
+
+  return node_row_count(t->pager, t->root_page_num);
+}
+
+// the number of rows with an id below key, found by adding up the counts of
+// the children left of the descent path
+uint32_t table_rank(table* t, uint32_t key) {
+  uint8_t* node = get_page(t->pager, t->root_page_num);
+  uint32_t i, child_index, res = 0;
+  uint32_t min_index, one_past_max_index;
+
+  while (get_node_type(node) == INTERNAL) {
+    child_index = inode_find_child(node, key);
+    for (i = 0; i < child_index; i++) res += *inode_count(node, i);
+    node = get_page(t->pager, *inode_child(node, child_index));
+  }
+
+  min_index = 0;
+  one_past_max_index = *lnode_num_cells(node);
+  while (one_past_max_index != min_index) {
+    uint32_t index = (min_index + one_past_max_index) / 2;
+    if (*lnode_key(node, index) < key) {
+      min_index = index + 1;
+    } else {
+      one_past_max_index = index;
+    }
+  }
+
+  return res + min_index;
+}
+
+// returns a cursor at the row with the given position in id order
+cursor* table_at(table* t, uint32_t offset) {
+  uint32_t page_num = t->root_page_num;
+  uint8_t* node = get_page(t->pager, page_num);
+  uint32_t i;
+  cursor* c = malloc(sizeof(cursor));
+
+  while (get_node_type(node) == INTERNAL) {
+    for (i = 0; i < *inode_num_keys(node); i++) {
+      if (offset < *inode_count(node, i)) break;
+      offset -= *inode_count(node, i);
+    }
+    page_num = *inode_child(node, i);
+    node = get_page(t->pager, page_num);
+  }
+
+  c->table = t;
+  c->pagen = page_num;
+  c->celln = offset;
+  c->end_of_table = offset >= *lnode_num_cells(node);
+
+  return c;
+}
+
 cursor* inode_find(table* t, uint32_t page_num, uint32_t key) {
   uint8_t* node = get_page(t->pager, page_num);
 
@@ -287,6 +633,9 @@ cursor* inode_find(table* t, uint32_t page_num, uint32_t key) {
       return lnode_find(t, child_num, key);
     case INTERNAL:
       return inode_find(t, child_num, key);
+    default:
+      puts("Found a hash page inside a B-tree.");
+      exit(1);
   }
 }
 
@@ -323,6 +672,9 @@ uint32_t get_node_max_key(uint8_t* node) {
       return *inode_key(node, *inode_num_keys(node) - 1);
     case LEAF:
       return *lnode_key(node, *lnode_num_cells(node) - 1);
+    default:
+      puts("Found a hash page inside a B-tree.");
+      exit(1);
   }
 }
 
@@ -351,13 +703,66 @@ void create_new_root(table* t, uint32_t right_pn) {
   uint32_t left_child_max_key = get_node_max_key(left_child);
   *inode_key(root, 0) = left_child_max_key;
   *inode_right_child(root) = right_pn;
+  *inode_count(root, 0) = node_row_count(t->pager, left_pn);
+  *inode_right_count(root) = node_row_count(t->pager, right_pn);
   *node_parent(left_child) = t->root_page_num;
   *node_parent(right_child) = t->root_page_num;
+
+  pager_mark_dirty(t->pager, t->root_page_num);
+  pager_mark_dirty(t->pager, left_pn);
+  pager_mark_dirty(t->pager, right_pn);
+}
+
+void note_insert(table* t, uint32_t key) {
+  if (key > t->last_key) {
+    t->insert_run = t->insert_run > 0 ? t->insert_run + 1 : 1;
+  } else {
+    t->insert_run = t->insert_run < 0 ? t->insert_run - 1 : -1;
+  }
+  t->last_key = key;
+}
+
+// picks how many of the LNODE_SPLIT_TOTAL cells stay in the left node.
+// Appending at the end of the rightmost leaf, or at the end of a leaf while
+// keys keep ascending, leaves the left node fill_factor full and starts a
+// nearly empty right one; descending inserts at the front mirror that.
+// Everything else splits in the middle.
+uint32_t lnode_split_point(cursor* c, uint32_t key, uint8_t* node) {
+  table* t = c->table;
+  uint32_t full = LNODE_MAX_CELLS * t->fill_factor / 100;
+
+  if (!full) full = 1;
+
+  t->splits.total++;
+
+  if (c->celln == LNODE_MAX_CELLS && !*lnode_next_leaf(node)) {
+    t->splits.append++;
+    return full;
+  }
+
+  // an ascending run inside the key range: the new key starts the right
+  // leaf, where the keys after it will land, and the cells before it stay
+  // behind. Runs near the front of the leaf split in the middle instead,
+  // which also leaves room after the new key.
+  if (key > t->last_key && t->insert_run >= SPLIT_HISTORY_RUN &&
+      c->celln > LNODE_LEFT_SPLIT_COUNT) {
+    t->splits.append++;
+    return c->celln;
+  }
+
+  if (c->celln == 0 && key < t->last_key &&
+      t->insert_run <= -SPLIT_HISTORY_RUN) {
+    t->splits.prepend++;
+    return LNODE_SPLIT_TOTAL - full;
+  }
+
+  return LNODE_LEFT_SPLIT_COUNT;
 }
 
 void lnode_split_and_insert(cursor* c, uint32_t key, row* value) {
   uint8_t* old_node = get_page(c->table->pager, c->pagen);
   uint32_t old_max = get_node_max_key(old_node);
+  uint32_t left_count = lnode_split_point(c, key, old_node);
   uint32_t new_page_num = get_unused_page_num(c->table->pager);
   uint8_t* new_node = get_page(c->table->pager, new_page_num);
   initialize_lnode(new_node);
@@ -367,8 +772,8 @@ void lnode_split_and_insert(cursor* c, uint32_t key, row* value) {
 
   for (int32_t i = LNODE_MAX_CELLS; i >= 0; i--) {
     uint8_t* dest_node;
-    dest_node = i >= LNODE_LEFT_SPLIT_COUNT ? new_node : old_node;
-    uint32_t index_within_node = i % LNODE_LEFT_SPLIT_COUNT;
+    dest_node = i >= left_count ? new_node : old_node;
+    uint32_t index_within_node = i >= left_count ? i - left_count : i;
     uint8_t* dest = lnode_cell(dest_node, index_within_node);
 
     if (i == c->celln) {
@@ -380,8 +785,10 @@ void lnode_split_and_insert(cursor* c, uint32_t key, row* value) {
       memcpy(dest, lnode_cell(old_node, i), LNODE_CELL_SIZE);
     }
   }
-  *(lnode_num_cells(old_node)) = LNODE_LEFT_SPLIT_COUNT;
-  *(lnode_num_cells(new_node)) = LNODE_RIGHT_SPLIT_COUNT;
+  *(lnode_num_cells(old_node)) = left_count;
+  *(lnode_num_cells(new_node)) = LNODE_SPLIT_TOTAL - left_count;
+  pager_mark_dirty(c->table->pager, c->pagen);
+  pager_mark_dirty(c->table->pager, new_page_num);
 
   if (is_node_root(old_node)) {
     create_new_root(c->table, new_page_num);
@@ -392,6 +799,8 @@ void lnode_split_and_insert(cursor* c, uint32_t key, row* value) {
 
     update_inode_key(parent, old_max, new_max);
     inode_insert(c->table, parent_page_num, new_page_num);
+    *inode_count(parent, inode_child_index(parent, c->pagen)) = left_count;
+    update_counts(c->table, parent_page_num, 1);
   }
 }
 
@@ -402,6 +811,7 @@ void lnode_insert(cursor* c, uint32_t key, row* value) {
 
   if (ncells >= LNODE_MAX_CELLS) {
     lnode_split_and_insert(c, key, value);
+    note_insert(c->table, key);
     return;
   }
 
@@ -414,6 +824,83 @@ void lnode_insert(cursor* c, uint32_t key, row* value) {
   *(lnode_num_cells(pg)) += 1;
   *(lnode_key(pg, c->celln)) = key;
   serialize_row(value, lnode_value(pg, c->celln));
+  pager_mark_dirty(c->table->pager, c->pagen);
+  update_counts(c->table, c->pagen, 1);
+  note_insert(c->table, key);
+}
+
+short lnode_has_key(uint8_t* node, uint32_t key) {
+  uint32_t min_index = 0;
+  uint32_t one_past_max_index = *lnode_num_cells(node);
+
+  while (one_past_max_index != min_index) {
+    uint32_t index = (min_index + one_past_max_index) / 2;
+    uint32_t key_at_index = *lnode_key(node, index);
+    if (key == key_at_index) return 1;
+    if (key < key_at_index) {
+      one_past_max_index = index;
+    } else {
+      min_index = index + 1;
+    }
+  }
+
+  return 0;
+}
+
+// inserts a run of rows (sorted by id, no duplicates among themselves) into
+// the leaf the cursor points at. The first row is known to belong here; the
+// following ones do as long as they do not exceed the leaf's current maximum
+// key, or unconditionally if this is the rightmost leaf. All rows that fit
+// are merged in from the back, so every existing cell moves at most once.
+// Returns the number of rows consumed; rows whose id is already present are
+// skipped and counted in *dups.
+uint32_t lnode_insert_batch(cursor* c, row* rows, uint32_t n, uint32_t* dups) {
+  uint8_t* pg = get_page(c->table->pager, c->pagen);
+  uint32_t ncells = *lnode_num_cells(pg);
+  uint32_t room = LNODE_MAX_CELLS - ncells;
+  short rightmost = !*lnode_next_leaf(pg);
+  uint32_t max_key = ncells ? *lnode_key(pg, ncells - 1) : 0;
+  uint32_t run, take;
+  int32_t i, j, dest;
+
+  if (!room) {
+    if (c->celln < ncells && *lnode_key(pg, c->celln) == rows[0].id) {
+      (*dups)++;
+    } else {
+      lnode_split_and_insert(c, rows[0].id, &rows[0]);
+      note_insert(c->table, rows[0].id);
+    }
+    return 1;
+  }
+
+  for (run = 0, take = 0; run < n && take < room; run++) {
+    if (run && !rightmost && rows[run].id > max_key) break;
+    if (rows[run].id <= max_key && lnode_has_key(pg, rows[run].id)) continue;
+    note_insert(c->table, rows[run].id);
+    take++;
+  }
+  *dups += run - take;
+
+  i = ncells - 1;
+  j = run - 1;
+  dest = ncells + take - 1;
+  while (j >= 0) {
+    if (i >= 0 && *lnode_key(pg, i) > rows[j].id) {
+      memcpy(lnode_cell(pg, dest--), lnode_cell(pg, i--), LNODE_CELL_SIZE);
+    } else if (i >= 0 && *lnode_key(pg, i) == rows[j].id) {
+      j--;
+    } else {
+      *lnode_key(pg, dest) = rows[j].id;
+      serialize_row(&rows[j], lnode_value(pg, dest--));
+      j--;
+    }
+  }
+
+  *lnode_num_cells(pg) = ncells + take;
+  pager_mark_dirty(c->table->pager, c->pagen);
+  if (take) update_counts(c->table, c->pagen, take);
+
+  return run;
 }
 
 cursor* lnode_find(table* t, uint32_t page_num, uint32_t key) {
@@ -473,7 +960,9 @@ void inode_insert(table* t, uint32_t parent_pn, uint32_t child_pn) {
   if (child_max_key > get_node_max_key(right_child)) {
     *inode_child(parent, original_num_keys) = right_child_pn;
     *inode_key(parent, original_num_keys) = get_node_max_key(right_child);
+    *inode_count(parent, original_num_keys) = *inode_right_count(parent);
     *inode_right_child(parent) = child_pn;
+    *inode_right_count(parent) = node_row_count(t->pager, child_pn);
   } else {
     for (uint32_t i = original_num_keys; i > index; i--) {
       uint8_t* dest = (uint8_t*)inode_cell(parent, i);
@@ -482,6 +971,9 @@ void inode_insert(table* t, uint32_t parent_pn, uint32_t child_pn) {
     }
     *inode_child(parent, index) = child_pn;
     *inode_key(parent, index) = child_max_key;
+    *inode_count(parent, index) = node_row_count(t->pager, child_pn);
   }
+
+  pager_mark_dirty(t->pager, parent_pn);
 }
 
@@ -1,15 +1,24 @@
 #pragma once
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum {
   INSERT,
-  SELECT
+  SELECT,
+  COUNT,
+  RANK
 } statement_type;
 
+// the values are stored in every page. LEGACY_INTERNAL marks internal
+// nodes written before they carried subtree counts; db_open upgrades them.
 typedef enum {
-  INTERNAL,
-  LEAF
+  LEGACY_INTERNAL,
+  LEAF,
+  HASH_DIRECTORY,
+  HASH_BUCKET,
+  INTERNAL
 } node_type;
 
 typedef struct {
@@ -20,22 +29,104 @@ typedef struct {
 
 #define TABLE_MAX_PAGES 100
 #define PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// flags for db_open; DB_HASH only matters when a new file is created
+#define DB_DIRECT_IO 1
+#define DB_HASH 2
 
 typedef struct {
   int fd;
+  char* filename;
   uint32_t flen;
   uint32_t npages;
+
+  // pages[i] points into arena once page i has been loaded; the arena is
+  // page-aligned so frames can be handed to O_DIRECT I/O as they are
   uint8_t* pages[TABLE_MAX_PAGES];
+  uint8_t* arena;
+  size_t arena_size;
+  short huge_pages;
+  short direct_io;
+
+  // dirty_since holds the epoch (number of completed write statements) at
+  // which a page first became dirty; checkpoint is the newest epoch whose
+  // changes are all on disk. Epochs are only kept in memory and start over
+  // at 0 when the file is opened again; closing checkpoints everything, so
+  // a reopened file has nothing older to account for.
+  uint8_t dirty[TABLE_MAX_PAGES];
+  uint64_t dirty_since[TABLE_MAX_PAGES];
+  uint32_t ndirty;
+  uint64_t epoch;
+  uint64_t checkpoint;
+  uint64_t pages_written;
+
+  // get_page calls served from the arena and those that had to read the
+  // file, for tracing
+  uint64_t page_hits;
+  uint64_t page_misses;
+
+  // the page the writer is writing from its private copy, or -1. Anyone
+  // else writing that page waits on written first, so the writer's older
+  // copy can never land on top of a newer one.
+  int writing;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t written;
+  pthread_t writer;
+  short writer_running;
+  short writer_stop;
 } pager;
 
+// inserts at the end of the rightmost leaf, and inserts after this many
+// ascending keys in a row, are treated as appends
+#define SPLIT_HISTORY_RUN 4
+#define DEFAULT_FILL_FACTOR 100
+
+// total, append and prepend count B-tree leaf splits; buckets and
+// doublings count bucket splits and directory doublings of a hash table
+typedef struct {
+  uint32_t total;
+  uint32_t append;
+  uint32_t prepend;
+  uint32_t buckets;
+  uint32_t doublings;
+} split_stats;
+
 typedef struct {
   pager* pager;
   uint32_t root_page_num;
+
+  // fill_factor is the percentage of a leaf kept on the full side of an
+  // append or prepend split; insert_run counts the most recent ascending
+  // (positive) or descending (negative) keys and ends at last_key
+  uint32_t fill_factor;
+  uint32_t last_key;
+  int32_t insert_run;
+  split_stats splits;
+
+  // statement trace, if one was requested
+  struct trace* trace;
 } table;
 
+// upper bound on the rows of a multi-row insert
+#define STATEMENT_MAX_ROWS 256
+
 typedef struct {
   statement_type type;
-  row row;
+
+  // a select or count restricted to ids in [min_id, max_id], of which
+  // offset rows are skipped and at most limit are returned; rank reports
+  // the position of min_id
+  short filtered;
+  uint32_t min_id;
+  uint32_t max_id;
+  uint32_t limit;
+  uint32_t offset;
+
+  uint32_t nrows;
+  row rows[STATEMENT_MAX_ROWS];
 } statement;
 
 typedef struct {
@@ -43,15 +134,29 @@ typedef struct {
   uint32_t pagen;
   uint32_t celln;
   short end_of_table;
+
+  // position in the hash directory when scanning a hash table
+  uint32_t diri;
 } cursor;
 
 uint8_t* cursor_value(cursor*);
-table* db_open(const char*);
+pager* pager_open(const char*, int);
+void pager_close(pager*);
+table* db_open(const char*, int);
 void db_close(table*);
 cursor* table_start(table*);
 cursor* table_find(table*, uint32_t);
+cursor* table_seek(table*, uint32_t);
+cursor* table_at(table*, uint32_t);
+uint32_t table_count(table*);
+uint32_t table_rank(table*, uint32_t);
+short table_is_hashed(table*);
 void cursor_advance(cursor*);
 uint8_t* get_page(pager*, uint32_t);
+uint32_t get_unused_page_num(pager*);
+void pager_mark_dirty(pager*, uint32_t);
+void pager_flush(pager*, uint32_t);
+uint64_t pager_checkpoint(pager*);
 
 extern const uint32_t NODE_T_SIZE;
 extern const uint32_t NODE_T_OFFSET;
@@ -80,13 +185,23 @@ uint32_t* lnode_key(uint8_t*, uint32_t);
 uint8_t* lnode_value(uint8_t*, uint32_t);
 void initialize_lnode(uint8_t*);
 void lnode_insert(cursor*, uint32_t, row*);
+uint32_t lnode_insert_batch(cursor*, row*, uint32_t, uint32_t*);
 cursor* lnode_find(table*, uint32_t, uint32_t);
 node_type get_node_type(uint8_t*);
 void set_node_type(uint8_t*, node_type);
+void set_node_root(uint8_t*, uint8_t);
+uint32_t* node_parent(uint8_t*);
+
+extern const uint32_t INODE_MAX_CELLS;
 
+void initialize_inode(uint8_t*);
 uint32_t* inode_num_keys(uint8_t*);
 uint32_t* inode_key(uint8_t*, uint32_t);
 uint32_t* inode_child(uint8_t* node, uint32_t child_num);
 uint32_t* inode_right_child(uint8_t* node);
+uint32_t* inode_right_count(uint8_t*);
+uint32_t* inode_count(uint8_t*, uint32_t);
 cursor* inode_find(table*, uint32_t, uint32_t);
+uint32_t upgrade_node(pager*, uint32_t);
+uint32_t upgrade_child(pager*, uint32_t, uint32_t);
 void inode_insert(table*, uint32_t, uint32_t);
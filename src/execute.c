@@ -2,48 +2,179 @@
 #include <stdlib.h>
 
 #include "execute.h"
+#include "hash.h"
 #include "serialize.h"
 
-void print_row(row* r) {
-  printf("(%d, %s, %s)\n", r->id, r->username, r->email);
+void print_row(row* r, FILE* out) {
+  fprintf(out, "(%d, %s, %s)\n", r->id, r->username, r->email);
 }
 
-exec_result execute_insert(statement* stmt, table* t) {
-  unsigned char* node = get_page(t->pager, t->root_page_num);
-  uint32_t ncells = *lnode_num_cells(node);
+int compare_rows(const void* a, const void* b) {
+  uint32_t x = ((const row*)a)->id;
+  uint32_t y = ((const row*)b)->id;
+
+  return (x > y) - (x < y);
+}
 
-  row* row_to_insert = &(stmt->row);
-  cursor* c = table_find(t, row_to_insert->id);
+// sorts the batch by key and then inserts it leaf by leaf: rows that land
+// on the same leaf share one descent and one shift of the existing cells
+exec_result insert_rows(statement* stmt, table* t) {
+  uint32_t i, n = 0, dups = 0;
+  cursor* c;
 
-  if (c->celln < ncells && row_to_insert->id == *lnode_key(node, c->celln)) {
-    return EXEC_DUPLICATE_KEY;
+  if (table_is_hashed(t)) {
+    for (i = 0; i < stmt->nrows; i++) {
+      switch (hash_insert(t, &stmt->rows[i])) {
+        case EXEC_TABLE_FULL:
+          return EXEC_TABLE_FULL;
+        case EXEC_DUPLICATE_KEY:
+          dups++;
+        default:
+          break;
+      }
+    }
+    return dups ? EXEC_DUPLICATE_KEY : EXEC_SUCCESS;
   }
 
-  lnode_insert(c, row_to_insert->id, row_to_insert);
+  qsort(stmt->rows, stmt->nrows, sizeof(row), compare_rows);
 
-  free(c);
+  for (i = 0; i < stmt->nrows; i++) {
+    if (n && stmt->rows[i].id == stmt->rows[n-1].id) {
+      dups++;
+      continue;
+    }
+    if (i != n) stmt->rows[n] = stmt->rows[i];
+    n++;
+  }
 
-  return EXEC_SUCCESS;
+  i = 0;
+  while (i < n) {
+    c = table_find(t, stmt->rows[i].id);
+    i += lnode_insert_batch(c, stmt->rows + i, n - i, &dups);
+    free(c);
+  }
+
+  return dups ? EXEC_DUPLICATE_KEY : EXEC_SUCCESS;
 }
 
-exec_result execute_select(statement* sttmt, table* t) {
+// the background writer may be copying pages out concurrently, so the whole
+// statement runs under the pager lock and counts as one checkpoint epoch.
+// The epoch advances even when the insert fails: a failed statement may
+// still have written some of its rows.
+exec_result execute_insert(statement* stmt, table* t) {
+  exec_result res;
+
+  pthread_mutex_lock(&t->pager->lock);
+  res = insert_rows(stmt, t);
+  t->pager->epoch++;
+  pthread_mutex_unlock(&t->pager->lock);
+
+  return res;
+}
+
+short row_selected(statement* stmt, row* r) {
+  return !stmt->filtered || (r->id >= stmt->min_id && r->id <= stmt->max_id);
+}
+
+// hash tables answer a single id with one probe and anything else with an
+// unordered full scan. B-trees seek straight to the first row to return,
+// using the subtree counts when there is an offset, and stop after the end
+// of the range.
+exec_result execute_select(statement* stmt, table* t, FILE* out) {
   row row;
-  cursor* c = table_start(t);
-  while (!(c->end_of_table)) {
+  short hashed = table_is_hashed(t);
+  uint32_t skipped = 0, shown = 0;
+  cursor* c;
+
+  if (hashed && stmt->filtered && stmt->min_id == stmt->max_id &&
+      !stmt->offset && stmt->limit) {
+    c = hash_find(t, stmt->min_id);
+    if (!(c->end_of_table)) {
+      deserialize_row(cursor_value(c), &row);
+      print_row(&row, out);
+    }
+    free(c);
+    return EXEC_SUCCESS;
+  }
+
+  if (hashed || (!stmt->filtered && !stmt->offset)) {
+    c = table_start(t);
+  } else if (!stmt->offset) {
+    c = table_seek(t, stmt->min_id);
+  } else {
+    uint32_t first = stmt->filtered ? table_rank(t, stmt->min_id) : 0;
+
+    // also keeps first + offset from wrapping around
+    if (stmt->offset >= table_count(t) - first) return EXEC_SUCCESS;
+    c = table_at(t, first + stmt->offset);
+  }
+
+  while (!(c->end_of_table) && shown < stmt->limit) {
     deserialize_row(cursor_value(c), &row);
-    print_row(&row);
+    if (!hashed && stmt->filtered && row.id > stmt->max_id) break;
+    if (row_selected(stmt, &row)) {
+      if (hashed && skipped < stmt->offset) {
+        skipped++;
+      } else {
+        print_row(&row, out);
+        shown++;
+      }
+    }
     cursor_advance(c);
   }
   free(c);
   return EXEC_SUCCESS;
 }
 
-exec_result execute(statement* stmt, table* t) {
+// B-tree counts are the difference of two ranks; hash tables have to scan
+// unless all rows are counted
+uint32_t count_rows(statement* stmt, table* t) {
+  uint32_t res = 0, upto;
+  row row;
+  cursor* c;
+
+  if (!stmt->filtered) return table_count(t);
+  if (stmt->min_id > stmt->max_id) return 0;
+
+  if (table_is_hashed(t)) {
+    c = table_start(t);
+    while (!(c->end_of_table)) {
+      deserialize_row(cursor_value(c), &row);
+      if (row_selected(stmt, &row)) res++;
+      cursor_advance(c);
+    }
+    free(c);
+    return res;
+  }
+
+  if (stmt->max_id == UINT32_MAX) upto = table_count(t);
+  else upto = table_rank(t, stmt->max_id + 1);
+
+  return upto - table_rank(t, stmt->min_id);
+}
+
+exec_result execute_count(statement* stmt, table* t, FILE* out) {
+  fprintf(out, "%u\n", count_rows(stmt, t));
+  return EXEC_SUCCESS;
+}
+
+exec_result execute_rank(statement* stmt, table* t, FILE* out) {
+  if (table_is_hashed(t)) return EXEC_UNORDERED;
+
+  fprintf(out, "%u\n", table_rank(t, stmt->min_id));
+  return EXEC_SUCCESS;
+}
+
+exec_result execute(statement* stmt, table* t, FILE* out) {
   switch (stmt->type) {
     case INSERT:
       return execute_insert(stmt, t);
     case SELECT:
-      return execute_select(stmt, t);
-      break;
+      return execute_select(stmt, t, out);
+    case COUNT:
+      return execute_count(stmt, t, out);
+    case RANK:
+      return execute_rank(stmt, t, out);
   }
+  return EXEC_SUCCESS;
 }
@@ -1,9 +1,14 @@
+#pragma once
+
+#include <stdio.h>
+
 #include "data.h"
 
 typedef enum {
   EXEC_SUCCESS,
   EXEC_TABLE_FULL,
   EXEC_DUPLICATE_KEY,
+  EXEC_UNORDERED,
 } exec_result;
 
-exec_result execute(statement*, table*);
+exec_result execute(statement*, table*, FILE*);
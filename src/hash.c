@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "serialize.h"
+
+uint32_t* hash_global_depth(uint8_t* dir) {
+  return (uint32_t*)(dir + NODE_HDR_SIZE);
+}
+
+uint32_t* hash_dir_entry(uint8_t* dir, uint32_t index) {
+  return (uint32_t*)(dir + NODE_HDR_SIZE + sizeof(uint32_t)) + index;
+}
+
+uint32_t* hash_local_depth(uint8_t* bucket) {
+  return lnode_next_leaf(bucket);
+}
+
+// murmur3's finalizer, so that the low bits used to index the directory
+// depend on all bits of the id
+uint32_t hash_key(uint32_t key) {
+  key ^= key >> 16;
+  key *= 0x85ebca6b;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35;
+  key ^= key >> 16;
+  return key;
+}
+
+uint32_t hash_mask(uint32_t depth) {
+  return (1u << depth) - 1;
+}
+
+void initialize_bucket(uint8_t* bucket, uint32_t local_depth) {
+  initialize_lnode(bucket);
+  set_node_type(bucket, HASH_BUCKET);
+  *hash_local_depth(bucket) = local_depth;
+}
+
+void initialize_hash(table* t) {
+  uint8_t* dir = get_page(t->pager, t->root_page_num);
+  uint8_t* bucket = get_page(t->pager, 1);
+
+  set_node_type(dir, HASH_DIRECTORY);
+  set_node_root(dir, 1);
+  *hash_global_depth(dir) = 0;
+  *hash_dir_entry(dir, 0) = 1;
+  initialize_bucket(bucket, 0);
+
+  pager_mark_dirty(t->pager, t->root_page_num);
+  pager_mark_dirty(t->pager, 1);
+}
+
+uint32_t bucket_for(table* t, uint32_t key) {
+  uint8_t* dir = get_page(t->pager, t->root_page_num);
+  uint32_t index = hash_key(key) & hash_mask(*hash_global_depth(dir));
+
+  return *hash_dir_entry(dir, index);
+}
+
+int32_t bucket_find(uint8_t* bucket, uint32_t key) {
+  uint32_t i, ncells = *lnode_num_cells(bucket);
+
+  for (i = 0; i < ncells; i++) {
+    if (*lnode_key(bucket, i) == key) return i;
+  }
+
+  return -1;
+}
+
+// splits a full bucket on bit local_depth of the hash, doubling the
+// directory first if the bucket is already distinguished by all of its bits
+exec_result hash_split(table* t, uint32_t page_num) {
+  uint8_t* dir = get_page(t->pager, t->root_page_num);
+  uint8_t* old = get_page(t->pager, page_num);
+  uint32_t depth = *hash_local_depth(old);
+  uint32_t global = *hash_global_depth(dir);
+  uint32_t new_page_num = get_unused_page_num(t->pager);
+  uint32_t i, kept = 0, ncells = *lnode_num_cells(old);
+  uint8_t* new;
+
+  if (depth == global && global == HASH_MAX_DEPTH) return EXEC_TABLE_FULL;
+  if (new_page_num >= TABLE_MAX_PAGES) return EXEC_TABLE_FULL;
+
+  if (depth == global) {
+    for (i = 0; i < (1u << global); i++) {
+      *hash_dir_entry(dir, i + (1u << global)) = *hash_dir_entry(dir, i);
+    }
+    *hash_global_depth(dir) = ++global;
+    t->splits.doublings++;
+  }
+
+  new = get_page(t->pager, new_page_num);
+  initialize_bucket(new, depth + 1);
+  *hash_local_depth(old) = depth + 1;
+
+  for (i = 0; i < ncells; i++) {
+    uint8_t* cell = lnode_cell(old, i);
+    uint8_t* dest_node = old;
+
+    if (hash_key(*lnode_key(old, i)) & (1u << depth)) dest_node = new;
+
+    if (dest_node == new) {
+      memcpy(lnode_cell(new, *lnode_num_cells(new)), cell, LNODE_CELL_SIZE);
+      *lnode_num_cells(new) += 1;
+    } else {
+      if (kept != i) memcpy(lnode_cell(old, kept), cell, LNODE_CELL_SIZE);
+      kept++;
+    }
+  }
+  *lnode_num_cells(old) = kept;
+
+  for (i = 0; i < (1u << global); i++) {
+    if (*hash_dir_entry(dir, i) == page_num && (i & (1u << depth))) {
+      *hash_dir_entry(dir, i) = new_page_num;
+    }
+  }
+
+  pager_mark_dirty(t->pager, t->root_page_num);
+  pager_mark_dirty(t->pager, page_num);
+  pager_mark_dirty(t->pager, new_page_num);
+  t->splits.buckets++;
+
+  return EXEC_SUCCESS;
+}
+
+exec_result hash_insert(table* t, row* value) {
+  uint32_t page_num, ncells;
+  uint8_t* bucket;
+  exec_result res;
+
+  while (1) {
+    page_num = bucket_for(t, value->id);
+    bucket = get_page(t->pager, page_num);
+    ncells = *lnode_num_cells(bucket);
+
+    if (bucket_find(bucket, value->id) >= 0) return EXEC_DUPLICATE_KEY;
+
+    if (ncells < LNODE_MAX_CELLS) break;
+    if ((res = hash_split(t, page_num)) != EXEC_SUCCESS) return res;
+  }
+
+  *lnode_key(bucket, ncells) = value->id;
+  serialize_row(value, lnode_value(bucket, ncells));
+  *lnode_num_cells(bucket) = ncells + 1;
+  pager_mark_dirty(t->pager, page_num);
+
+  return EXEC_SUCCESS;
+}
+
+cursor* hash_find(table* t, uint32_t key) {
+  cursor* c = malloc(sizeof(cursor));
+  int32_t celln;
+
+  c->table = t;
+  c->pagen = bucket_for(t, key);
+  c->diri = 0;
+  celln = bucket_find(get_page(t->pager, c->pagen), key);
+  c->celln = celln < 0 ? 0 : celln;
+  c->end_of_table = celln < 0;
+
+  return c;
+}
+
+// moves the cursor to the first cell of the next non-empty bucket at or
+// after directory entry from. A bucket of local depth d appears at every
+// 2^d-th entry, so we only visit it at its first one, i.e. below 2^d.
+void hash_seek_bucket(cursor* c, uint32_t from) {
+  uint8_t* dir = get_page(c->table->pager, c->table->root_page_num);
+  uint32_t entries = 1u << *hash_global_depth(dir);
+  uint8_t* bucket;
+
+  for (c->diri = from; c->diri < entries; c->diri++) {
+    c->pagen = *hash_dir_entry(dir, c->diri);
+    bucket = get_page(c->table->pager, c->pagen);
+
+    if (c->diri >= (1u << *hash_local_depth(bucket))) continue;
+    if (!*lnode_num_cells(bucket)) continue;
+
+    c->celln = 0;
+    c->end_of_table = 0;
+    return;
+  }
+
+  c->end_of_table = 1;
+}
+
+cursor* hash_start(table* t) {
+  cursor* c = malloc(sizeof(cursor));
+
+  c->table = t;
+  hash_seek_bucket(c, 0);
+
+  return c;
+}
+
+void hash_cursor_advance(cursor* c) {
+  uint8_t* bucket = get_page(c->table->pager, c->pagen);
+
+  c->celln += 1;
+
+  if (c->celln >= *lnode_num_cells(bucket)) hash_seek_bucket(c, c->diri + 1);
+}
+
+uint32_t hash_count(table* t) {
+  uint8_t* dir = get_page(t->pager, t->root_page_num);
+  uint32_t i, res = 0;
+  uint8_t* bucket;
+
+  for (i = 0; i < (1u << *hash_global_depth(dir)); i++) {
+    bucket = get_page(t->pager, *hash_dir_entry(dir, i));
+    if (i < (1u << *hash_local_depth(bucket))) res += *lnode_num_cells(bucket);
+  }
+
+  return res;
+}
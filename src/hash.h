@@ -0,0 +1,21 @@
+#pragma once
+
+#include "data.h"
+#include "execute.h"
+
+// a hash table keeps its directory in the root page: the global depth
+// followed by 2^depth bucket page numbers. Buckets are laid out like leaves,
+// except that the cells are unordered and the next-leaf slot holds the
+// bucket's local depth.
+#define HASH_MAX_DEPTH 9
+
+void initialize_hash(table*);
+exec_result hash_insert(table*, row*);
+cursor* hash_find(table*, uint32_t);
+cursor* hash_start(table*);
+uint32_t hash_count(table*);
+void hash_cursor_advance(cursor*);
+
+uint32_t* hash_global_depth(uint8_t*);
+uint32_t* hash_dir_entry(uint8_t*, uint32_t);
+uint32_t* hash_local_depth(uint8_t*);
@@ -2,76 +2,274 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
 #include "meta.h"
+#include "snapshot.h"
+#include "vacuum.h"
 
-void print_constants() {
-  puts("Constants:");
-  printf("ROW_SIZE: %ld\n", sizeof(row));
-  printf("NODE_HDR_SIZE: %d\n", NODE_HDR_SIZE);
-  printf("LNODE_HDR_SIZE: %d\n", LNODE_HDR_SIZE);
-  printf("LNODE_CELL_SIZE: %d\n", LNODE_CELL_SIZE);
-  printf("LNODE_SPACE_FOR_CELLS: %d\n", LNODE_SPACE_FOR_CELLS);
-  printf("LNODE_MAX_CELLS: %d\n", LNODE_MAX_CELLS);
+void print_constants(FILE* out) {
+  fputs("Constants:\n", out);
+  fprintf(out, "ROW_SIZE: %ld\n", sizeof(row));
+  fprintf(out, "NODE_HDR_SIZE: %d\n", NODE_HDR_SIZE);
+  fprintf(out, "LNODE_HDR_SIZE: %d\n", LNODE_HDR_SIZE);
+  fprintf(out, "LNODE_CELL_SIZE: %d\n", LNODE_CELL_SIZE);
+  fprintf(out, "LNODE_SPACE_FOR_CELLS: %d\n", LNODE_SPACE_FOR_CELLS);
+  fprintf(out, "LNODE_MAX_CELLS: %d\n", LNODE_MAX_CELLS);
 }
 
-void indent(uint32_t level) {
+void indent(uint32_t level, FILE* out) {
   int i;
-  for (i = 0; i < level; i++) printf("  ");
+  for (i = 0; i < level; i++) fprintf(out, "  ");
 }
 
-void print_tree(pager* p, uint32_t page_num, uint32_t indent_lvl) {
+void print_tree(pager* p, uint32_t page_num, uint32_t indent_lvl,
+                FILE* out) {
   void* node = get_page(p, page_num);
   uint32_t num_keys, child;
 
   switch (get_node_type(node)) {
     case LEAF:
       num_keys = *lnode_num_cells(node);
-      indent(indent_lvl);
-      printf("- leaf (size %d)\n", num_keys);
+      indent(indent_lvl, out);
+      fprintf(out, "- leaf (size %d)\n", num_keys);
       for (uint32_t i = 0; i < num_keys; i++) {
-        indent(indent_lvl + 1);
-        printf("- %d\n", *lnode_key(node, i));
+        indent(indent_lvl + 1, out);
+        fprintf(out, "- %d\n", *lnode_key(node, i));
       }
       break;
     case INTERNAL:
       num_keys = *inode_num_keys(node);
-      indent(indent_lvl);
-      printf("- internal (size %d)\n", num_keys);
+      indent(indent_lvl, out);
+      fprintf(out, "- internal (size %d)\n", num_keys);
       for (uint32_t i = 0; i < num_keys; i++) {
         child = *inode_child(node, i);
-        print_tree(p, child, indent_lvl + 1);
+        print_tree(p, child, indent_lvl + 1, out);
 
-        indent(indent_lvl);
-        printf("- key %d\n", *inode_key(node, i));
+        indent(indent_lvl, out);
+        fprintf(out, "- key %d\n", *inode_key(node, i));
       }
       child = *inode_right_child(node);
-      print_tree(p, child, indent_lvl + 1);
+      print_tree(p, child, indent_lvl + 1, out);
       break;
+    case HASH_DIRECTORY:
+      num_keys = *hash_global_depth(node);
+      indent(indent_lvl, out);
+      fprintf(out, "- hash directory (depth %d)\n", num_keys);
+      for (uint32_t i = 0; i < (1u << num_keys); i++) {
+        child = *hash_dir_entry(node, i);
+        // every bucket is printed once, at its lowest directory entry
+        if (i < (1u << *hash_local_depth(get_page(p, child)))) {
+          print_tree(p, child, indent_lvl + 1, out);
+        }
+      }
+      break;
+    case HASH_BUCKET:
+      num_keys = *lnode_num_cells(node);
+      indent(indent_lvl, out);
+      fprintf(out, "- bucket (size %d, depth %d)\n", num_keys,
+              *hash_local_depth(node));
+      for (uint32_t i = 0; i < num_keys; i++) {
+        indent(indent_lvl + 1, out);
+        fprintf(out, "- %d\n", *lnode_key(node, i));
+      }
+      break;
+    case LEGACY_INTERNAL:
+      // db_open upgrades these, so one showing up means a corrupt tree
+      indent(indent_lvl, out);
+      fputs("- legacy internal node\n", out);
+      break;
+  }
+}
+
+void print_writer_stats(pager* p, FILE* out) {
+  pthread_mutex_lock(&p->lock);
+  fputs("Writer:\n", out);
+  fprintf(out, "running: %s\n", p->writer_running ? "yes" : "no");
+  fprintf(out, "dirty pages: %u\n", p->ndirty);
+  fprintf(out, "pages written: %llu\n", (unsigned long long)p->pages_written);
+  fprintf(out, "epoch: %llu\n", (unsigned long long)p->epoch);
+  fprintf(out, "checkpoint: %llu\n", (unsigned long long)p->checkpoint);
+  pthread_mutex_unlock(&p->lock);
+}
+
+void print_pager_info(pager* p, FILE* out) {
+  uint32_t i, cached = 0;
+
+  for (i = 0; i < TABLE_MAX_PAGES; i++) {
+    if (p->pages[i]) cached++;
+  }
+
+  fputs("Pager:\n", out);
+  fprintf(out, "arena: %zu bytes\n", p->arena_size);
+  fprintf(out, "huge pages: %s\n", p->huge_pages ? "yes" : "no");
+  fprintf(out, "direct I/O: %s\n", p->direct_io ? "yes" : "no");
+  fprintf(out, "cached pages: %u/%d\n", cached, TABLE_MAX_PAGES);
+}
+
+meta_result meta_vacuum(char* args, table* t, FILE* out) {
+  int fill_factor = t->fill_factor;
+
+  if (*args && sscanf(args, "%d", &fill_factor) != 1) {
+    return META_UNRECOGNIZED;
+  }
+
+  if (fill_factor < 1 || fill_factor > 100) {
+    fputs("Fill factor must be between 1 and 100.\n", out);
+    return META_SUCCESS;
+  }
+
+  switch (table_vacuum(t, fill_factor)) {
+    case VACUUM_TOO_LARGE:
+      fputs("Error: vacuumed table would not fit!\n", out);
+      break;
+    case VACUUM_UNSUPPORTED:
+      fputs("Error: only B-tree tables can be vacuumed!\n", out);
+      break;
+    case VACUUM_SUCCESS:
+      fputs("Vacuumed.\n", out);
+      break;
+  }
+
+  return META_SUCCESS;
+}
+
+void print_split_stats(table* t, FILE* out) {
+  fputs("Splits:\n", out);
+  fprintf(out, "fill factor: %u\n", t->fill_factor);
+  fprintf(out, "total: %u\n", t->splits.total);
+  fprintf(out, "append: %u\n", t->splits.append);
+  fprintf(out, "prepend: %u\n", t->splits.prepend);
+  fprintf(out, "middle: %u\n",
+         t->splits.total - t->splits.append - t->splits.prepend);
+
+  if (table_is_hashed(t)) {
+    fprintf(out, "buckets: %u\n", t->splits.buckets);
+    fprintf(out, "directory doublings: %u\n", t->splits.doublings);
+  }
+}
+
+meta_result meta_fill_factor(char* args, table* t, FILE* out) {
+  int fill_factor;
+
+  if (sscanf(args, "%d", &fill_factor) != 1) return META_UNRECOGNIZED;
+
+  if (fill_factor < 1 || fill_factor > 100) {
+    fputs("Fill factor must be between 1 and 100.\n", out);
+    return META_SUCCESS;
+  }
+
+  t->fill_factor = fill_factor;
+  return META_SUCCESS;
+}
+
+// the file name follows the command after a single space
+const char* meta_path(char* args) {
+  if (*args != ' ' || !args[1]) return NULL;
+  return args + 1;
+}
+
+meta_result meta_export(char* args, table* t, FILE* out) {
+  const char* path = meta_path(args);
+  uint32_t nrows;
+
+  if (!path) return META_UNRECOGNIZED;
+
+  if (snapshot_export(t, path, &nrows) != SNAPSHOT_SUCCESS) {
+    fprintf(out, "Error: could not write snapshot to %s.\n", path);
+    return META_SUCCESS;
   }
+
+  fprintf(out, "Exported %u rows.\n", nrows);
+  return META_SUCCESS;
 }
 
-meta_result meta(char* input, table* t) {
-  if (!strcmp(input, ":q")) {
-    db_close(t);
-    puts("Goodbye!");
-    exit(0);
+// reads a snapshot back through the mapped columns
+meta_result meta_snapshot(char* args, FILE* out) {
+  const char* path = meta_path(args);
+  const char *username, *email;
+  uint32_t i, ulen, elen;
+  snapshot* s;
+
+  if (!path) return META_UNRECOGNIZED;
+
+  if (!(s = snapshot_open(path))) {
+    fprintf(out, "Error: %s is not a valid snapshot.\n", path);
+    return META_SUCCESS;
+  }
+
+  fprintf(out, "Snapshot: %u rows in %u blocks\n",
+          s->header->nrows, s->header->nblocks);
+  for (i = 0; i < s->header->nblocks; i++) {
+    fprintf(out, "block %u: ids %u-%u\n",
+            i, s->blocks[i].min_id, s->blocks[i].max_id);
+  }
+  for (i = 0; i < s->header->nrows; i++) {
+    username = snapshot_username(s, i, &ulen);
+    email = snapshot_email(s, i, &elen);
+    fprintf(out, "(%u, %.*s, %.*s)\n",
+            s->ids[i], (int)ulen, username, (int)elen, email);
   }
 
+  snapshot_close(s);
+  return META_SUCCESS;
+}
+
+meta_result meta(char* input, table* t, FILE* out) {
+  if (!strcmp(input, ":q")) return META_QUIT;
+
   if (!strcmp(input, ":c")) {
-    print_constants();
+    print_constants(out);
     return META_SUCCESS;
   }
 
   if (!strcmp(input, ":tree")) {
-    puts("Tree:");
-    print_tree(t->pager, 0, 0);
+    fputs("Tree:\n", out);
+    print_tree(t->pager, 0, 0, out);
+    return META_SUCCESS;
+  }
+
+  if (!strcmp(input, ":checkpoint")) {
+    uint64_t ckpt = pager_checkpoint(t->pager);
+    fprintf(out, "Checkpoint: %llu statements durable.\n",
+            (unsigned long long)ckpt);
+    return META_SUCCESS;
+  }
+
+  if (!strcmp(input, ":pager")) {
+    print_pager_info(t->pager, out);
     return META_SUCCESS;
   }
 
+  if (!strcmp(input, ":writer")) {
+    print_writer_stats(t->pager, out);
+    return META_SUCCESS;
+  }
+
+  if (!strcmp(input, ":splits")) {
+    print_split_stats(t, out);
+    return META_SUCCESS;
+  }
+
+  if (!strncmp(input, ":fillfactor", 11)) {
+    return meta_fill_factor(input + 11, t, out);
+  }
+
+  if (!strncmp(input, ":vacuum", 7)) {
+    return meta_vacuum(input + 7, t, out);
+  }
+
+  if (!strncmp(input, ":export", 7)) {
+    return meta_export(input + 7, t, out);
+  }
+
+  if (!strncmp(input, ":snapshot", 9)) {
+    return meta_snapshot(input + 9, out);
+  }
+
   if (!strcmp(input, ":d") || !strcmp(input, "dbg")) {
-    print_constants();
-    puts("\nTree:");
-    print_tree(t->pager, 0, 0);
+    print_constants(out);
+    fputs("\nTree:\n", out);
+    print_tree(t->pager, 0, 0, out);
     return META_SUCCESS;
   }
 
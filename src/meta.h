@@ -1,8 +1,13 @@
+#pragma once
+
+#include <stdio.h>
+
 #include "data.h"
 
 typedef enum {
   META_SUCCESS,
+  META_QUIT,
   META_UNRECOGNIZED
 } meta_result;
 
-meta_result meta(char*, table*);
+meta_result meta(char*, table*, FILE*);
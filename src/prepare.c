@@ -4,26 +4,205 @@
 
 #include "prepare.h"
 
-prep_result prepare_insert(char* input, statement* stmt) {
+// the tokenizer never copies or allocates: tokens are slices of the input
+// line, and only the final field values are copied into the row batch
+typedef struct {
+  const char* start;
+  uint32_t len;
+} token;
+
+void skip_spaces(const char** s) {
+  while (**s == ' ' || **s == '\t') (*s)++;
+}
+
+short expect_char(const char** s, char ch) {
+  skip_spaces(s);
+  if (**s != ch) return 0;
+  (*s)++;
+  return 1;
+}
+
+short expect_word(const char** s, const char* word) {
+  size_t len = strlen(word);
+
+  skip_spaces(s);
+  if (strncmp(*s, word, len)) return 0;
+  (*s) += len;
+  return 1;
+}
+
+short parse_number(const char** s, uint32_t* n) {
+  uint64_t value = 0;
+  const char* start;
+
+  skip_spaces(s);
+  start = *s;
+  while (**s >= '0' && **s <= '9') {
+    value = value * 10 + (**s - '0');
+    if (value > UINT32_MAX) return 0;
+    (*s)++;
+  }
+
+  if (*s == start) return 0;
+
+  *n = value;
+  return 1;
+}
+
+prep_result parse_id(const char** s, uint32_t* id) {
+  short negative = expect_char(s, '-');
+
+  if (!parse_number(s, id)) return PREP_SYNTAX_ERROR;
+  if (negative || !*id) return PREP_NEG_ID;
+
+  return PREP_SUCCESS;
+}
+
+// a string is either quoted with single quotes or a bare word that runs up
+// to the next whitespace or one of the given delimiters
+short parse_string(const char** s, const char* delims, token* tok) {
+  skip_spaces(s);
+
+  if (**s == '\'') {
+    tok->start = ++(*s);
+    while (**s && **s != '\'') (*s)++;
+    if (!**s) return 0;
+    tok->len = *s - tok->start;
+    (*s)++;
+    return 1;
+  }
+
+  tok->start = *s;
+  while (**s && **s != ' ' && **s != '\t' && !strchr(delims, **s)) (*s)++;
+  tok->len = *s - tok->start;
+
+  return tok->len > 0;
+}
+
+prep_result copy_field(char* dest, size_t size, token* tok) {
+  if (tok->len >= size) return PREP_STRING_TOO_LONG;
+
+  memcpy(dest, tok->start, tok->len);
+  dest[tok->len] = '\0';
+
+  return PREP_SUCCESS;
+}
+
+prep_result fill_row(row* r, uint32_t id, token* username, token* email) {
+  prep_result res;
+
+  r->id = id;
+  if ((res = copy_field(r->username, sizeof(r->username), username))) {
+    return res;
+  }
+  return copy_field(r->email, sizeof(r->email), email);
+}
+
+// (id, username, email)
+prep_result parse_tuple(const char** s, row* r) {
+  prep_result res;
+  uint32_t id;
+  token username, email;
+
+  if (!expect_char(s, '(')) return PREP_SYNTAX_ERROR;
+  if ((res = parse_id(s, &id))) return res;
+  if (!expect_char(s, ',')) return PREP_SYNTAX_ERROR;
+  if (!parse_string(s, ",)", &username)) return PREP_SYNTAX_ERROR;
+  if (!expect_char(s, ',')) return PREP_SYNTAX_ERROR;
+  if (!parse_string(s, ",)", &email)) return PREP_SYNTAX_ERROR;
+  if (!expect_char(s, ')')) return PREP_SYNTAX_ERROR;
+
+  return fill_row(r, id, &username, &email);
+}
+
+prep_result prepare_values(const char* s, statement* stmt) {
+  prep_result res;
+
+  do {
+    if (stmt->nrows >= STATEMENT_MAX_ROWS) return PREP_TOO_MANY_ROWS;
+    if ((res = parse_tuple(&s, &stmt->rows[stmt->nrows]))) return res;
+    stmt->nrows++;
+  } while (expect_char(&s, ','));
+
+  skip_spaces(&s);
+  if (*s) return PREP_SYNTAX_ERROR;
+
+  return PREP_SUCCESS;
+}
+
+prep_result prepare_insert(const char* input, statement* stmt) {
+  const char* s = input + strlen("insert");
+  prep_result res;
+  uint32_t id;
+  token username, email;
+
   stmt->type = INSERT;
+  stmt->nrows = 0;
+
+  if (expect_word(&s, "values")) return prepare_values(s, stmt);
+
+  if ((res = parse_id(&s, &id))) return res;
+  if (!parse_string(&s, "", &username)) return PREP_SYNTAX_ERROR;
+  if (!parse_string(&s, "", &email)) return PREP_SYNTAX_ERROR;
+
+  if ((res = fill_row(&stmt->rows[0], id, &username, &email))) return res;
+  stmt->nrows = 1;
 
-  strtok(input, " ");
-  char* id_string = strtok(NULL, " ");
-  char* username = strtok(NULL, " ");
-  char* email = strtok(NULL, " ");
+  return PREP_SUCCESS;
+}
+
+// where id = N | where id between A and B
+prep_result parse_where(const char** s, statement* stmt) {
+  prep_result res;
+
+  if (!expect_word(s, "id")) return PREP_SYNTAX_ERROR;
+
+  if (expect_char(s, '=')) {
+    if ((res = parse_id(s, &stmt->min_id))) return res;
+    stmt->max_id = stmt->min_id;
+  } else if (expect_word(s, "between")) {
+    if ((res = parse_id(s, &stmt->min_id))) return res;
+    if (!expect_word(s, "and")) return PREP_SYNTAX_ERROR;
+    if ((res = parse_id(s, &stmt->max_id))) return res;
+  } else {
+    return PREP_SYNTAX_ERROR;
+  }
+
+  stmt->filtered = 1;
+  return PREP_SUCCESS;
+}
+
+// select [count(*) | rank N] [where ...] [limit N] [offset M]
+prep_result prepare_select(const char* input, statement* stmt) {
+  const char* s = input + strlen("select");
+  prep_result res;
 
-  if (!id_string || !username || !email) return PREP_SYNTAX_ERROR;
+  stmt->type = SELECT;
+  stmt->filtered = 0;
+  stmt->limit = UINT32_MAX;
+  stmt->offset = 0;
+
+  if (expect_word(&s, "count(*)")) {
+    stmt->type = COUNT;
+  } else if (expect_word(&s, "rank")) {
+    stmt->type = RANK;
+    if ((res = parse_id(&s, &stmt->min_id))) return res;
+  }
 
-  int id = atoi(id_string);
+  if (stmt->type != RANK && expect_word(&s, "where")) {
+    if ((res = parse_where(&s, stmt))) return res;
+  }
 
-  if (id < 1) return PREP_NEG_ID;
+  if (stmt->type == SELECT && expect_word(&s, "limit")) {
+    if (!parse_number(&s, &stmt->limit)) return PREP_SYNTAX_ERROR;
+  }
 
-  if (strlen(username) > 32) return PREP_STRING_TOO_LONG;
-  if (strlen(email) > 255) return PREP_STRING_TOO_LONG;
+  if (stmt->type == SELECT && expect_word(&s, "offset")) {
+    if (!parse_number(&s, &stmt->offset)) return PREP_SYNTAX_ERROR;
+  }
 
-  stmt->row.id = id;
-  strcpy(stmt->row.username, username);
-  strcpy(stmt->row.email, email);
+  skip_spaces(&s);
+  if (*s) return PREP_SYNTAX_ERROR;
 
   return PREP_SUCCESS;
 }
@@ -31,10 +210,7 @@ prep_result prepare_insert(char* input, statement* stmt) {
 prep_result prepare_statement(char* input, statement* stmt) {
   if (!strncmp(input, "insert", 6)) return prepare_insert(input, stmt);
 
-  if (!strncmp(input, "select", 6)) {
-    stmt->type = SELECT;
-    return PREP_SUCCESS;
-  }
+  if (!strncmp(input, "select", 6)) return prepare_select(input, stmt);
 
   return PREP_UNRECOGNIZED;
 }
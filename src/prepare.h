@@ -1,3 +1,5 @@
+#pragma once
+
 #include "data.h"
 
 typedef enum {
@@ -6,6 +8,7 @@ typedef enum {
   PREP_UNRECOGNIZED,
   PREP_STRING_TOO_LONG,
   PREP_NEG_ID,
+  PREP_TOO_MANY_ROWS,
 } prep_result;
 
 prep_result prepare_statement(char*, statement*);
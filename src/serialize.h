@@ -1,3 +1,5 @@
+#pragma once
+
 #include "data.h"
 
 void serialize_row(row*, unsigned char*);
@@ -0,0 +1,363 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include "server.h"
+#include "session.h"
+
+// Clients send the same lines they would type at the prompt and may send
+// many of them without waiting for replies. Each reply is what the prompt
+// would print, minus any empty lines, followed by an empty line, so clients
+// can match replies to pipelined statements.
+
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_SIZE 65536
+#define SERVER_MAX_LINE (1 << 20)
+#define SERVER_MAX_IOV 64
+
+#ifdef __linux__
+
+typedef struct {
+  char* buf;
+  size_t len;
+} chunk;
+
+typedef struct connection {
+  int fd;
+  char* in;
+  size_t in_len;
+  size_t in_cap;
+
+  // replies waiting to be written; out_off bytes of the first chunk are
+  // already on the wire
+  chunk* out;
+  uint32_t nout;
+  uint32_t out_cap;
+  size_t out_off;
+
+  short closing;
+
+  // events registered with epoll
+  uint32_t events;
+  struct connection* prev;
+  struct connection* next;
+} connection;
+
+static volatile sig_atomic_t stopping = 0;
+
+// there is only one thread evaluating statements, so all connections can
+// share a single statement buffer
+static statement stmt;
+
+void handle_stop(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+
+  if (flags < 0) return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int listen_unix(const char* path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    puts("Socket path is too long.");
+    return -1;
+  }
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    printf("Error creating socket: %d.\n", errno);
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0 || set_nonblocking(fd) < 0) {
+    printf("Error listening on '%s': %d.\n", path, errno);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// a closing connection reads no more input, so it stops watching for it;
+// epoll is level-triggered and would otherwise keep reporting it
+void conn_watch(int epfd, connection* c, short want_write) {
+  struct epoll_event ev;
+
+  ev.events = (c->closing ? 0 : EPOLLIN) | (want_write ? EPOLLOUT : 0);
+  if (c->events == ev.events) return;
+
+  ev.data.ptr = c;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+  c->events = ev.events;
+}
+
+void conn_queue(connection* c, char* buf, size_t len) {
+  if (!len) {
+    free(buf);
+    return;
+  }
+
+  if (c->nout == c->out_cap) {
+    c->out_cap = c->out_cap ? c->out_cap * 2 : 8;
+    c->out = realloc(c->out, c->out_cap * sizeof(chunk));
+  }
+
+  c->out[c->nout].buf = buf;
+  c->out[c->nout].len = len;
+  c->nout++;
+}
+
+// writes as much of the queued output as the socket takes, gathering up to
+// SERVER_MAX_IOV replies per writev. Returns -1 if the peer is gone.
+int conn_flush(connection* c) {
+  struct iovec iov[SERVER_MAX_IOV];
+  uint32_t i, n, done;
+  ssize_t written;
+
+  while (c->nout) {
+    n = c->nout < SERVER_MAX_IOV ? c->nout : SERVER_MAX_IOV;
+    for (i = 0; i < n; i++) {
+      iov[i].iov_base = c->out[i].buf + (i ? 0 : c->out_off);
+      iov[i].iov_len = c->out[i].len - (i ? 0 : c->out_off);
+    }
+
+    written = writev(c->fd, iov, n);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+      return -1;
+    }
+
+    for (done = 0; done < c->nout; done++) {
+      size_t left = c->out[done].len - c->out_off;
+
+      if ((size_t)written < left) {
+        c->out_off += written;
+        break;
+      }
+      written -= left;
+      c->out_off = 0;
+      free(c->out[done].buf);
+    }
+
+    memmove(c->out, c->out + done, (c->nout - done) * sizeof(chunk));
+    c->nout -= done;
+  }
+
+  return 0;
+}
+
+// copies the output of one statement to out without its empty lines, which
+// would read as the end of the reply, and ends it with one
+void frame_reply(FILE* out, const char* reply, size_t len) {
+  const char* end = reply + len;
+  const char* nl;
+
+  while (reply < end) {
+    if (!(nl = memchr(reply, '\n', end - reply))) nl = end;
+
+    if (nl > reply) {
+      fwrite(reply, 1, nl - reply, out);
+      fputc('\n', out);
+    }
+    reply = nl + 1;
+  }
+
+  fputc('\n', out);
+}
+
+// evaluates every complete line in the input buffer. All replies produced
+// by one read end up in a single chunk; each statement writes to a scratch
+// stream first so that its reply can be framed.
+void conn_process(connection* c, table* t) {
+  char* line = c->in;
+  char* end;
+  char *reply, *eval;
+  size_t reply_len, eval_len;
+  FILE* out = open_memstream(&reply, &reply_len);
+  FILE* eval_out = open_memstream(&eval, &eval_len);
+
+  while (!c->closing && (end = memchr(line, '\n', c->in + c->in_len - line))) {
+    *end = '\0';
+    if (end > line && end[-1] == '\r') end[-1] = '\0';
+
+    rewind(eval_out);
+    if (session_eval(line, t, &stmt, eval_out) == SESSION_QUIT) {
+      c->closing = 1;
+    }
+    fflush(eval_out);
+    frame_reply(out, eval, ftell(eval_out));
+
+    line = end + 1;
+  }
+
+  fclose(eval_out);
+  free(eval);
+  fclose(out);
+  conn_queue(c, reply, reply_len);
+
+  c->in_len -= line - c->in;
+  memmove(c->in, line, c->in_len);
+
+  if (c->in_len > SERVER_MAX_LINE) {
+    c->closing = 1;
+    c->in_len = 0;
+  }
+}
+
+void conn_close(connection** conns, connection* c) {
+  uint32_t i;
+
+  close(c->fd);
+
+  for (i = 0; i < c->nout; i++) free(c->out[i].buf);
+  free(c->out);
+  free(c->in);
+
+  if (c->prev) c->prev->next = c->next;
+  else *conns = c->next;
+  if (c->next) c->next->prev = c->prev;
+
+  free(c);
+}
+
+void accept_all(int epfd, int listen_fd, connection** conns) {
+  struct epoll_event ev;
+  connection* c;
+  int fd;
+
+  while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+    if (set_nonblocking(fd) < 0) {
+      close(fd);
+      continue;
+    }
+
+    c = calloc(1, sizeof(connection));
+    c->fd = fd;
+    c->next = *conns;
+    if (*conns) (*conns)->prev = c;
+    *conns = c;
+
+    ev.events = c->events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+// reads what is available, runs the complete statements and writes back
+// what it can. Returns 0 once the connection should be closed.
+int conn_handle(int epfd, connection* c, uint32_t events, table* t) {
+  ssize_t n;
+
+  if (events & EPOLLIN && !c->closing) {
+    if (c->in_cap - c->in_len < SERVER_READ_SIZE) {
+      c->in_cap = c->in_len + SERVER_READ_SIZE;
+      c->in = realloc(c->in, c->in_cap);
+    }
+
+    n = read(c->fd, c->in + c->in_len, SERVER_READ_SIZE);
+    if (n == 0) {
+      c->closing = 1;
+    } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+      return 0;
+    } else if (n > 0) {
+      c->in_len += n;
+      conn_process(c, t);
+    }
+  } else if (events & (EPOLLERR | EPOLLHUP)) {
+    c->closing = 1;
+  }
+
+  if (conn_flush(c) < 0) return 0;
+  if (c->nout) {
+    conn_watch(epfd, c, 1);
+    return 1;
+  }
+
+  conn_watch(epfd, c, 0);
+  return !c->closing;
+}
+
+// serves the table on a Unix domain socket until SIGINT or SIGTERM. One
+// thread owns the table and its page cache and multiplexes all clients.
+int serve(table* t, const char* path) {
+  struct epoll_event ev, events[SERVER_MAX_EVENTS];
+  connection* conns = NULL;
+  int epfd, listen_fd, n, i;
+
+  if ((listen_fd = listen_unix(path)) < 0) return 1;
+
+  if ((epfd = epoll_create1(0)) < 0) {
+    printf("Error creating epoll instance: %d.\n", errno);
+    close(listen_fd);
+    return 1;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, handle_stop);
+  signal(SIGTERM, handle_stop);
+
+  while (!stopping) {
+    n = epoll_wait(epfd, events, SERVER_MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      printf("Error waiting for events: %d.\n", errno);
+      break;
+    }
+
+    for (i = 0; i < n; i++) {
+      connection* c = events[i].data.ptr;
+
+      if (!c) {
+        accept_all(epfd, listen_fd, &conns);
+      } else if (!conn_handle(epfd, c, events[i].events, t)) {
+        conn_close(&conns, c);
+      }
+    }
+  }
+
+  while (conns) conn_close(&conns, conns);
+  close(epfd);
+  close(listen_fd);
+  unlink(path);
+
+  return 0;
+}
+
+#else
+
+int serve(table* t, const char* path) {
+  (void)t;
+  (void)path;
+  puts("Server mode requires epoll.");
+  return 1;
+}
+
+#endif
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "data.h"
+
+int serve(table*, const char*);
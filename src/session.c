@@ -0,0 +1,89 @@
+#include "execute.h"
+#include "meta.h"
+#include "prepare.h"
+#include "session.h"
+#include "trace.h"
+
+trace_type statement_trace_type(statement* stmt) {
+  switch (stmt->type) {
+    case INSERT:
+      return TRACE_INSERT;
+    case SELECT:
+      return TRACE_SELECT;
+    case COUNT:
+      return TRACE_COUNT;
+    case RANK:
+      return TRACE_RANK;
+  }
+  return TRACE_INVALID;
+}
+
+session_result evaluate(char* input, table* t, statement* stmt, FILE* out,
+                        trace_type* type) {
+  *type = TRACE_INVALID;
+
+  if (input[0] == ':') {
+    *type = TRACE_META;
+    switch (meta(input, t, out)) {
+      case META_QUIT:
+        fputs("Goodbye!\n", out);
+        return SESSION_QUIT;
+      case META_UNRECOGNIZED:
+        fprintf(out, "Unrecognized command '%s'.\n", input);
+      default:
+        break;
+    }
+    return SESSION_CONTINUE;
+  }
+
+  switch (prepare_statement(input, stmt)) {
+    case PREP_UNRECOGNIZED:
+      fprintf(out, "Unrecognized keyword at start of '%s'.\n", input);
+      break;
+    case PREP_SYNTAX_ERROR:
+      fprintf(out, "Syntax error. Could not parse statement '%s'.\n", input);
+      break;
+    case PREP_STRING_TOO_LONG:
+      fputs("A string is too long.\n", out);
+      break;
+    case PREP_NEG_ID:
+      fputs("ID must be positive.\n", out);
+      break;
+    case PREP_TOO_MANY_ROWS:
+      fprintf(out, "Too many rows in one statement (max %d).\n",
+              STATEMENT_MAX_ROWS);
+      break;
+    case PREP_SUCCESS:
+      *type = statement_trace_type(stmt);
+      switch (execute(stmt, t, out)) {
+        case EXEC_TABLE_FULL:
+          fputs("Error: table full!\n", out);
+          break;
+        case EXEC_DUPLICATE_KEY:
+          fputs("Error: duplicate key!\n", out);
+          break;
+        case EXEC_UNORDERED:
+          fputs("Error: table is not ordered!\n", out);
+          break;
+        case EXEC_SUCCESS:
+          break;
+      }
+  }
+
+  return SESSION_CONTINUE;
+}
+
+// evaluates one line of input, be it a meta command or a statement, and
+// writes everything the user should see to out. Shared by the interactive
+// loop and the socket server.
+session_result session_eval(char* input, table* t, statement* stmt,
+                            FILE* out) {
+  session_result res;
+  trace_type type;
+
+  if (t->trace) trace_begin(t->trace, t);
+  res = evaluate(input, t, stmt, out, &type);
+  if (t->trace) trace_end(t->trace, t, input, type);
+
+  return res;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "data.h"
+
+typedef enum {
+  SESSION_CONTINUE,
+  SESSION_QUIT
+} session_result;
+
+session_result session_eval(char*, table*, statement*, FILE*);
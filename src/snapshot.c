@@ -0,0 +1,233 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "serialize.h"
+#include "snapshot.h"
+
+uint64_t snapshot_align(uint64_t offset) {
+  return (offset + SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_ALIGN - 1);
+}
+
+// pads the file with zeroes up to offset
+int write_padding(FILE* f, uint64_t offset) {
+  static const char zeroes[SNAPSHOT_ALIGN];
+  long pos = ftell(f);
+
+  if (pos < 0 || (uint64_t)pos > offset) return -1;
+  if (fwrite(zeroes, 1, offset - pos, f) != offset - pos) return -1;
+
+  return 0;
+}
+
+int write_section(FILE* f, uint64_t offset, const void* data, size_t size) {
+  if (write_padding(f, offset) < 0) return -1;
+  if (fwrite(data, 1, size, f) != size) return -1;
+
+  return 0;
+}
+
+// gathers the columns in memory in one scan of the table and writes them
+// out to a temporary file that is renamed into place once complete
+snapshot_result snapshot_export(table* t, const char* path, uint32_t* nrows) {
+  uint32_t n = table_count(t);
+  uint32_t nblocks = (n + SNAPSHOT_BLOCK_ROWS - 1) / SNAPSHOT_BLOCK_ROWS;
+  uint32_t* ids = malloc(n * sizeof(uint32_t) + 1);
+  uint32_t* username_offsets = malloc((n + 1) * sizeof(uint32_t));
+  uint32_t* email_offsets = malloc((n + 1) * sizeof(uint32_t));
+  char* usernames = malloc(n * sizeof(((row*)0)->username) + 1);
+  char* emails = malloc(n * sizeof(((row*)0)->email) + 1);
+  snapshot_block* blocks = malloc(nblocks * sizeof(snapshot_block) + 1);
+  char* tmp = malloc(strlen(path) + strlen(".tmp") + 1);
+  snapshot_header h;
+  snapshot_result res = SNAPSHOT_SUCCESS;
+  uint32_t i = 0, len;
+  cursor* c;
+  FILE* f;
+  row r;
+
+  username_offsets[0] = 0;
+  email_offsets[0] = 0;
+
+  for (c = table_start(t); !(c->end_of_table) && i < n; cursor_advance(c)) {
+    snapshot_block* b = &blocks[i / SNAPSHOT_BLOCK_ROWS];
+
+    deserialize_row(cursor_value(c), &r);
+    ids[i] = r.id;
+
+    len = strlen(r.username);
+    memcpy(usernames + username_offsets[i], r.username, len);
+    username_offsets[i+1] = username_offsets[i] + len;
+
+    len = strlen(r.email);
+    memcpy(emails + email_offsets[i], r.email, len);
+    email_offsets[i+1] = email_offsets[i] + len;
+
+    if (i % SNAPSHOT_BLOCK_ROWS == 0 || r.id < b->min_id) b->min_id = r.id;
+    if (i % SNAPSHOT_BLOCK_ROWS == 0 || r.id > b->max_id) b->max_id = r.id;
+    i++;
+  }
+  free(c);
+
+  memset(&h, 0, sizeof(h));
+  strcpy(h.magic, SNAPSHOT_MAGIC);
+  h.version = SNAPSHOT_VERSION;
+  h.nrows = n;
+  h.block_rows = SNAPSHOT_BLOCK_ROWS;
+  h.nblocks = nblocks;
+  h.ids_offset = snapshot_align(sizeof(h));
+  h.username_offsets_offset =
+    snapshot_align(h.ids_offset + n * sizeof(uint32_t));
+  h.username_bytes_offset =
+    snapshot_align(h.username_offsets_offset + (n + 1) * sizeof(uint32_t));
+  h.email_offsets_offset =
+    snapshot_align(h.username_bytes_offset + username_offsets[n]);
+  h.email_bytes_offset =
+    snapshot_align(h.email_offsets_offset + (n + 1) * sizeof(uint32_t));
+  h.footer_offset = snapshot_align(h.email_bytes_offset + email_offsets[n]);
+
+  sprintf(tmp, "%s.tmp", path);
+  if (!(f = fopen(tmp, "wb"))) {
+    res = SNAPSHOT_IO_ERROR;
+  } else {
+    if (fwrite(&h, sizeof(h), 1, f) != 1 ||
+        write_section(f, h.ids_offset, ids, n * sizeof(uint32_t)) ||
+        write_section(f, h.username_offsets_offset, username_offsets,
+                      (n + 1) * sizeof(uint32_t)) ||
+        write_section(f, h.username_bytes_offset, usernames,
+                      username_offsets[n]) ||
+        write_section(f, h.email_offsets_offset, email_offsets,
+                      (n + 1) * sizeof(uint32_t)) ||
+        write_section(f, h.email_bytes_offset, emails, email_offsets[n]) ||
+        write_section(f, h.footer_offset, blocks,
+                      nblocks * sizeof(snapshot_block))) {
+      res = SNAPSHOT_IO_ERROR;
+    }
+
+    // the data must be on disk before the rename can expose it
+    if (res == SNAPSHOT_SUCCESS && (fflush(f) || fsync(fileno(f)) < 0)) {
+      res = SNAPSHOT_IO_ERROR;
+    }
+
+    if (fclose(f) || res != SNAPSHOT_SUCCESS || rename(tmp, path) < 0) {
+      unlink(tmp);
+      res = SNAPSHOT_IO_ERROR;
+    }
+  }
+
+  free(ids);
+  free(username_offsets);
+  free(email_offsets);
+  free(usernames);
+  free(emails);
+  free(blocks);
+  free(tmp);
+
+  *nrows = n;
+  return res;
+}
+
+short section_fits(snapshot* s, uint64_t offset, uint64_t size) {
+  return offset % SNAPSHOT_ALIGN == 0 && offset <= s->size &&
+         size <= s->size - offset;
+}
+
+// a string column is usable if its offsets start at 0, never decrease and
+// end within the file
+short string_column_valid(snapshot* s, uint64_t offsets_offset,
+                          uint64_t bytes_offset) {
+  const uint32_t* offsets = (const uint32_t*)(s->base + offsets_offset);
+  uint32_t i;
+
+  if (offsets[0]) return 0;
+  for (i = 0; i < s->header->nrows; i++) {
+    if (offsets[i+1] < offsets[i]) return 0;
+  }
+
+  return section_fits(s, bytes_offset, offsets[s->header->nrows]);
+}
+
+// checks everything the readers rely on: every section lies within the
+// file, the blocks cover the rows and every string lies within its column
+short snapshot_valid(snapshot* s) {
+  const snapshot_header* h = s->header;
+  uint64_t offsets_size = ((uint64_t)h->nrows + 1) * sizeof(uint32_t);
+
+  if (s->size < sizeof(snapshot_header)) return 0;
+  if (strncmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) ||
+      h->version != SNAPSHOT_VERSION) {
+    return 0;
+  }
+  if (!h->block_rows ||
+      h->nblocks != ((uint64_t)h->nrows + h->block_rows - 1) / h->block_rows) {
+    return 0;
+  }
+
+  return section_fits(s, h->ids_offset, (uint64_t)h->nrows * sizeof(uint32_t))
+    && section_fits(s, h->username_offsets_offset, offsets_size)
+    && section_fits(s, h->email_offsets_offset, offsets_size)
+    && section_fits(s, h->footer_offset,
+                    (uint64_t)h->nblocks * sizeof(snapshot_block))
+    && string_column_valid(s, h->username_offsets_offset,
+                           h->username_bytes_offset)
+    && string_column_valid(s, h->email_offsets_offset, h->email_bytes_offset);
+}
+
+// maps a snapshot read-only; columns are used in place, nothing is parsed
+snapshot* snapshot_open(const char* path) {
+  struct stat st;
+  snapshot* s;
+  void* base;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) return NULL;
+
+  if (fstat(fd, &st) < 0 || !st.st_size) {
+    close(fd);
+    return NULL;
+  }
+
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return NULL;
+
+  s = malloc(sizeof(snapshot));
+  s->base = base;
+  s->size = st.st_size;
+  s->header = base;
+
+  if (!snapshot_valid(s)) {
+    snapshot_close(s);
+    return NULL;
+  }
+
+  s->ids = (const uint32_t*)(s->base + s->header->ids_offset);
+  s->username_offsets =
+    (const uint32_t*)(s->base + s->header->username_offsets_offset);
+  s->username_bytes = (const char*)(s->base + s->header->username_bytes_offset);
+  s->email_offsets =
+    (const uint32_t*)(s->base + s->header->email_offsets_offset);
+  s->email_bytes = (const char*)(s->base + s->header->email_bytes_offset);
+  s->blocks = (const snapshot_block*)(s->base + s->header->footer_offset);
+
+  return s;
+}
+
+void snapshot_close(snapshot* s) {
+  munmap(s->base, s->size);
+  free(s);
+}
+
+const char* snapshot_username(snapshot* s, uint32_t i, uint32_t* len) {
+  *len = s->username_offsets[i+1] - s->username_offsets[i];
+  return s->username_bytes + s->username_offsets[i];
+}
+
+const char* snapshot_email(snapshot* s, uint32_t i, uint32_t* len) {
+  *len = s->email_offsets[i+1] - s->email_offsets[i];
+  return s->email_bytes + s->email_offsets[i];
+}
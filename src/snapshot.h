@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data.h"
+
+// A snapshot is a read-only, column-major copy of a table meant to be
+// mapped into memory by analytics jobs. After the header come, each
+// starting on a SNAPSHOT_ALIGN boundary: the id column, the username
+// offsets (nrows + 1 of them) and bytes, the email offsets and bytes, and
+// a footer with the smallest and largest id of every SNAPSHOT_BLOCK_ROWS
+// rows. Strings are not NUL-terminated; row i spans offsets[i] to
+// offsets[i+1].
+#define SNAPSHOT_MAGIC "DBCOLS1"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN 64
+#define SNAPSHOT_BLOCK_ROWS 1024
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t nrows;
+  uint32_t block_rows;
+  uint32_t nblocks;
+  uint64_t ids_offset;
+  uint64_t username_offsets_offset;
+  uint64_t username_bytes_offset;
+  uint64_t email_offsets_offset;
+  uint64_t email_bytes_offset;
+  uint64_t footer_offset;
+} snapshot_header;
+
+typedef struct {
+  uint32_t min_id;
+  uint32_t max_id;
+} snapshot_block;
+
+typedef struct {
+  uint8_t* base;
+  size_t size;
+  const snapshot_header* header;
+  const uint32_t* ids;
+  const uint32_t* username_offsets;
+  const char* username_bytes;
+  const uint32_t* email_offsets;
+  const char* email_bytes;
+  const snapshot_block* blocks;
+} snapshot;
+
+typedef enum {
+  SNAPSHOT_SUCCESS,
+  SNAPSHOT_IO_ERROR,
+} snapshot_result;
+
+snapshot_result snapshot_export(table*, const char*, uint32_t*);
+
+snapshot* snapshot_open(const char*);
+void snapshot_close(snapshot*);
+const char* snapshot_username(snapshot*, uint32_t, uint32_t*);
+const char* snapshot_email(snapshot*, uint32_t, uint32_t*);
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+uint64_t elapsed_ns(const struct timespec* from, const struct timespec* to) {
+  return (uint64_t)(to->tv_sec - from->tv_sec) * 1000000000 +
+         to->tv_nsec - from->tv_nsec;
+}
+
+const char* trace_type_name(trace_type type) {
+  switch (type) {
+    case TRACE_INSERT:
+      return "insert";
+    case TRACE_SELECT:
+      return "select";
+    case TRACE_COUNT:
+      return "count";
+    case TRACE_RANK:
+      return "rank";
+    case TRACE_META:
+      return "meta";
+    default:
+      return "invalid";
+  }
+}
+
+trace* trace_open(const char* path, int flags) {
+  trace_header h;
+  struct timespec now;
+  trace* tr = malloc(sizeof(trace));
+
+  if (!(tr->f = fopen(path, "wb"))) {
+    free(tr);
+    return NULL;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+  h.version = TRACE_VERSION;
+  h.flags = flags;
+  h.started_at = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  fwrite(&h, sizeof(h), 1, tr->f);
+
+  clock_gettime(CLOCK_MONOTONIC, &tr->opened);
+  return tr;
+}
+
+void trace_close(trace* tr) {
+  fclose(tr->f);
+  free(tr);
+}
+
+void trace_begin(trace* tr, table* t) {
+  tr->pager = t->pager;
+  tr->page_hits = t->pager->page_hits;
+  tr->page_misses = t->pager->page_misses;
+  tr->splits = t->splits.total + t->splits.buckets;
+  tr->doublings = t->splits.doublings;
+  clock_gettime(CLOCK_MONOTONIC, &tr->start);
+}
+
+// appends a record for the line evaluated since trace_begin. A vacuum swaps
+// in a new pager, in which case its counters are taken as they are.
+void trace_end(trace* tr, table* t, const char* input, trace_type type) {
+  struct timespec end;
+  trace_record rec;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (t->pager != tr->pager) tr->page_hits = tr->page_misses = 0;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.start = elapsed_ns(&tr->opened, &tr->start);
+  rec.latency = elapsed_ns(&tr->start, &end);
+  rec.page_hits = t->pager->page_hits - tr->page_hits;
+  rec.page_misses = t->pager->page_misses - tr->page_misses;
+  rec.splits = t->splits.total + t->splits.buckets - tr->splits;
+  rec.doublings = t->splits.doublings - tr->doublings;
+  rec.type = type;
+  rec.len = strlen(input);
+
+  // flushed per record so a crash or kill loses at most the line that
+  // caused it, which is the part of the trace most worth having
+  fwrite(&rec, sizeof(rec), 1, tr->f);
+  fwrite(input, 1, rec.len, tr->f);
+  fflush(tr->f);
+}
+
+FILE* trace_read_open(const char* path, trace_header* h) {
+  FILE* f = fopen(path, "rb");
+
+  if (!f) return NULL;
+
+  if (fread(h, sizeof(*h), 1, f) != 1 ||
+      memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) ||
+      h->version != TRACE_VERSION) {
+    fclose(f);
+    return NULL;
+  }
+
+  return f;
+}
+
+// reads the next record and returns its text, NUL-terminated, for the
+// caller to free; NULL at the end of the trace or on a truncated record
+char* trace_read(FILE* f, trace_record* rec) {
+  char* text;
+
+  if (fread(rec, sizeof(*rec), 1, f) != 1) return NULL;
+
+  text = malloc(rec->len + 1);
+  if (fread(text, 1, rec->len, f) != rec->len) {
+    free(text);
+    return NULL;
+  }
+  text[rec->len] = '\0';
+
+  return text;
+}
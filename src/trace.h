@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "data.h"
+
+// A trace is a binary log of every line a session evaluated: a header
+// followed by one fixed-size record per line, each trailed by the line's
+// text. Times are nanoseconds on the monotonic clock, relative to when the
+// trace was opened.
+#define TRACE_MAGIC "DBTRACE1"
+#define TRACE_VERSION 1
+
+typedef enum {
+  TRACE_INSERT,
+  TRACE_SELECT,
+  TRACE_COUNT,
+  TRACE_RANK,
+  TRACE_META,
+  TRACE_INVALID,
+  TRACE_NTYPES
+} trace_type;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;       // db_open flags of the traced database
+  uint64_t started_at;  // wall clock, nanoseconds since the epoch
+} trace_header;
+
+typedef struct {
+  uint64_t start;
+  uint64_t latency;
+  uint32_t page_hits;
+  uint32_t page_misses;
+  uint16_t splits;     // B-tree leaf splits plus hash bucket splits
+  uint8_t type;
+  uint8_t doublings;   // hash directory doublings
+  uint32_t len;
+} trace_record;
+
+_Static_assert(sizeof(trace_record) == 32, "trace records must be packed");
+
+typedef struct trace {
+  FILE* f;
+  struct timespec opened;
+
+  // state captured by trace_begin for the line being evaluated
+  struct timespec start;
+  pager* pager;
+  uint64_t page_hits;
+  uint64_t page_misses;
+  uint32_t splits;
+  uint32_t doublings;
+} trace;
+
+trace* trace_open(const char*, int);
+void trace_close(trace*);
+void trace_begin(trace*, table*);
+void trace_end(trace*, table*, const char*, trace_type);
+
+FILE* trace_read_open(const char*, trace_header*);
+char* trace_read(FILE*, trace_record*);
+
+uint64_t elapsed_ns(const struct timespec*, const struct timespec*);
+const char* trace_type_name(trace_type);
@@ -0,0 +1,193 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vacuum.h"
+#include "writer.h"
+
+uint32_t div_ceil(uint32_t a, uint32_t b) {
+  return (a + b - 1) / b;
+}
+
+// internal nodes cannot be split yet, so each one is left with a free key
+// for every child it gets: whichever leaves fill up afterwards, each can
+// split once into its parent
+uint32_t inode_fanout() {
+  return (INODE_MAX_CELLS + 1) / 2;
+}
+
+// the number of internal nodes above n children. Children are spread
+// evenly, so when n is not a multiple of the fanout some nodes get one
+// more child rather than one node getting a single child.
+uint32_t level_parents(uint32_t n) {
+  return n < 2 * inode_fanout() ? 1 : n / inode_fanout();
+}
+
+// copies all rows in key order into leaves numbered from first_leaf upwards,
+// packing rows_per_leaf into each, and records every leaf's page number,
+// maximum key and row count for the level above
+void write_leaves(table* t, pager* dest, uint32_t first_leaf,
+                  uint32_t rows_per_leaf, uint32_t* pages, uint32_t* keys,
+                  uint32_t* counts) {
+  uint32_t nleaves = 0;
+  uint8_t* leaf = NULL;
+  uint8_t* src;
+  cursor* c = table_start(t);
+
+  while (!(c->end_of_table)) {
+    if (!leaf || *lnode_num_cells(leaf) == rows_per_leaf) {
+      if (leaf) *lnode_next_leaf(leaf) = first_leaf + nleaves;
+      pages[nleaves] = first_leaf + nleaves;
+      leaf = get_page(dest, pages[nleaves]);
+      initialize_lnode(leaf);
+      pager_mark_dirty(dest, pages[nleaves]);
+      nleaves++;
+    }
+
+    src = get_page(t->pager, c->pagen);
+    memcpy(lnode_cell(leaf, *lnode_num_cells(leaf)), lnode_cell(src, c->celln),
+           LNODE_CELL_SIZE);
+    keys[nleaves-1] = *lnode_key(src, c->celln);
+    *lnode_num_cells(leaf) += 1;
+    counts[nleaves-1] = *lnode_num_cells(leaf);
+
+    cursor_advance(c);
+  }
+  free(c);
+
+  if (!leaf) {
+    leaf = get_page(dest, first_leaf);
+    initialize_lnode(leaf);
+    pager_mark_dirty(dest, first_leaf);
+  }
+}
+
+// builds the internal levels bottom-up over n children, level_parents(n)
+// internal nodes per level. The last node built is the root and goes to
+// page 0; all others are allocated after the leaves.
+void write_inodes(pager* dest, uint32_t* pages, uint32_t* keys,
+                  uint32_t* counts, uint32_t n) {
+  uint32_t next_page = pages[n-1] + 1;
+  uint32_t i, j, nparents, nchildren, first, page_num, total;
+  uint8_t* node;
+
+  while (n > 1) {
+    nparents = level_parents(n);
+
+    for (i = 0, first = 0; i < nparents; i++, first += nchildren) {
+      page_num = nparents == 1 ? 0 : next_page++;
+      nchildren = n / nparents + (i < n % nparents);
+      node = get_page(dest, page_num);
+      initialize_inode(node);
+      *inode_num_keys(node) = nchildren - 1;
+      total = 0;
+
+      for (j = 0; j < nchildren; j++) {
+        uint32_t child = first + j;
+
+        *node_parent(get_page(dest, pages[child])) = page_num;
+        if (j < nchildren - 1) {
+          *inode_child(node, j) = pages[child];
+          *inode_key(node, j) = keys[child];
+        } else {
+          *inode_right_child(node) = pages[child];
+        }
+        *inode_count(node, j) = counts[child];
+        total += counts[child];
+      }
+
+      pages[i] = page_num;
+      keys[i] = keys[first + nchildren - 1];
+      counts[i] = total;
+      pager_mark_dirty(dest, page_num);
+    }
+
+    n = nparents;
+  }
+
+  set_node_root(get_page(dest, 0), 1);
+}
+
+// makes a rename in the directory holding path durable
+void sync_parent_dir(const char* path) {
+  const char* slash = strrchr(path, '/');
+  char* dir = malloc(slash ? slash - path + 2 : 2);
+  int fd;
+
+  if (slash) {
+    memcpy(dir, path, slash - path + 1);
+    dir[slash - path + 1] = '\0';
+  } else {
+    strcpy(dir, ".");
+  }
+
+  if ((fd = open(dir, O_RDONLY)) < 0 || fsync(fd) < 0) {
+    printf("Error syncing directory: %d.\n", errno);
+    exit(1);
+  }
+
+  close(fd);
+  free(dir);
+}
+
+// rewrites the table into a fresh file whose leaves are in key order,
+// physically contiguous and filled to fill_factor percent, then renames it
+// over the original. Until the rename the old file stays untouched, so a
+// crash midway leaves the table as it was.
+vacuum_result table_vacuum(table* t, uint32_t fill_factor) {
+  if (table_is_hashed(t)) return VACUUM_UNSUPPORTED;
+
+  uint32_t rows = table_count(t);
+  uint32_t rows_per_leaf = LNODE_MAX_CELLS * fill_factor / 100;
+  uint32_t nleaves, npages, level, first_leaf;
+  uint32_t pages[TABLE_MAX_PAGES], keys[TABLE_MAX_PAGES];
+  uint32_t counts[TABLE_MAX_PAGES];
+  pager* old = t->pager;
+  pager* dest;
+  char* tmp;
+  char* filename;
+
+  if (!rows_per_leaf) rows_per_leaf = 1;
+  nleaves = rows ? div_ceil(rows, rows_per_leaf) : 1;
+
+  npages = nleaves;
+  for (level = nleaves; level > 1; level = level_parents(level)) {
+    npages += level_parents(level);
+  }
+  if (npages > TABLE_MAX_PAGES) return VACUUM_TOO_LARGE;
+
+  tmp = malloc(strlen(old->filename) + strlen(".vacuum") + 1);
+  sprintf(tmp, "%s.vacuum", old->filename);
+  unlink(tmp);
+
+  dest = pager_open(tmp, old->direct_io ? DB_DIRECT_IO : 0);
+  first_leaf = nleaves > 1 ? 1 : 0;
+  write_leaves(t, dest, first_leaf, rows_per_leaf, pages, keys, counts);
+  write_inodes(dest, pages, keys, counts, nleaves);
+
+  // carry the statement count over so checkpoints stay monotonic. The
+  // checkpoint fsyncs the new file, so it is complete before it is renamed.
+  dest->epoch = old->epoch;
+  pager_checkpoint(dest);
+
+  filename = old->filename;
+  old->filename = tmp;
+  pager_close(old);
+
+  if (rename(dest->filename, filename) < 0) {
+    printf("Error renaming: %d.\n", errno);
+    exit(1);
+  }
+  sync_parent_dir(filename);
+
+  free(dest->filename);
+  dest->filename = filename;
+  t->pager = dest;
+  t->root_page_num = 0;
+  writer_start(dest);
+
+  return VACUUM_SUCCESS;
+}
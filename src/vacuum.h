@@ -0,0 +1,11 @@
+#pragma once
+
+#include "data.h"
+
+typedef enum {
+  VACUUM_SUCCESS,
+  VACUUM_TOO_LARGE,
+  VACUUM_UNSUPPORTED,
+} vacuum_result;
+
+vacuum_result table_vacuum(table*, uint32_t);
@@ -0,0 +1,120 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "writer.h"
+
+int oldest_dirty_page(pager* p) {
+  int i;
+  int res = -1;
+
+  for (i = 0; i < TABLE_MAX_PAGES; i++) {
+    if (!p->dirty[i]) continue;
+    if (res < 0 || p->dirty_since[i] < p->dirty_since[res]) res = i;
+  }
+
+  return res;
+}
+
+// the epoch up to which every change has reached the file
+uint64_t consistent_epoch(pager* p) {
+  int oldest = oldest_dirty_page(p);
+
+  return oldest < 0 ? p->epoch : p->dirty_since[oldest];
+}
+
+void* writer_loop(void* arg) {
+  pager* p = arg;
+  struct timespec deadline;
+  // aligned so the copy can be written with O_DIRECT
+  uint8_t* buf = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+  uint32_t budget, written;
+  uint64_t candidate;
+  int page_num;
+
+  pthread_mutex_lock(&p->lock);
+  while (!p->writer_stop) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += WRITER_INTERVAL_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    if (p->ndirty < DIRTY_HIGH_WATERMARK) {
+      pthread_cond_timedwait(&p->wake, &p->lock, &deadline);
+    }
+    if (p->writer_stop) break;
+
+    if (p->ndirty >= DIRTY_HIGH_WATERMARK) {
+      budget = p->ndirty - DIRTY_LOW_WATERMARK;
+    } else {
+      budget = WRITER_PAGES_PER_TICK;
+    }
+
+    // pages are copied out under the lock and written without it, so
+    // statements only ever wait for a memcpy
+    for (written = 0; written < budget; written++) {
+      if ((page_num = oldest_dirty_page(p)) < 0) break;
+
+      memcpy(buf, p->pages[page_num], PAGE_SIZE);
+      p->dirty[page_num] = 0;
+      p->ndirty--;
+      p->writing = page_num;
+      pthread_mutex_unlock(&p->lock);
+
+      if (pwrite(p->fd, buf, PAGE_SIZE, (off_t)page_num*PAGE_SIZE) < 0) {
+        printf("Error writing: %d.\n", errno);
+        exit(1);
+      }
+
+      pthread_mutex_lock(&p->lock);
+      p->writing = -1;
+      pthread_cond_broadcast(&p->written);
+      p->pages_written++;
+    }
+
+    if (!written) continue;
+
+    // incremental checkpoint: everything older than the oldest page that is
+    // still dirty is now in the file, so once it is synced we can say so
+    candidate = consistent_epoch(p);
+    pthread_mutex_unlock(&p->lock);
+
+    if (fsync(p->fd) < 0) {
+      printf("Error syncing: %d.\n", errno);
+      exit(1);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    if (candidate > p->checkpoint) p->checkpoint = candidate;
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  free(buf);
+  return NULL;
+}
+
+void writer_start(pager* p) {
+  p->writer_stop = 0;
+
+  if (pthread_create(&p->writer, NULL, writer_loop, p)) {
+    puts("Error starting background writer.");
+    exit(1);
+  }
+
+  p->writer_running = 1;
+}
+
+void writer_stop(pager* p) {
+  if (!p->writer_running) return;
+
+  pthread_mutex_lock(&p->lock);
+  p->writer_stop = 1;
+  pthread_cond_signal(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+
+  pthread_join(p->writer, NULL);
+  p->writer_running = 0;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "data.h"
+
+// the background writer wakes up every WRITER_INTERVAL_MS and writes back at
+// most WRITER_PAGES_PER_TICK of the oldest dirty pages. Once the number of
+// dirty pages reaches the high watermark it is woken early and keeps going
+// until it is back down to the low watermark.
+#define WRITER_INTERVAL_MS 50
+#define WRITER_PAGES_PER_TICK 4
+#define DIRTY_HIGH_WATERMARK (TABLE_MAX_PAGES / 2)
+#define DIRTY_LOW_WATERMARK (TABLE_MAX_PAGES / 8)
+
+void writer_start(pager*);
+void writer_stop(pager*);